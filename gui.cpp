@@ -7,7 +7,9 @@
 #include "imgui.h"
 #include "imgui_impl_sdl.h"
 #include "imgui_impl_opengl3.h"
+#include "nes/audio_filter.hpp"
 #include "nes/emulate.hpp"
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <cmath>
@@ -15,9 +17,11 @@
 #include <future>
 #include <iostream>
 #include <optional>
+#include <span>
 #include <stdio.h>
 #include <string>
 #include <tuple>
+#include <vector>
 #include <SDL.h>
 #include <SDL_opengl.h>
 
@@ -487,18 +491,19 @@ void destroy_window(SDL_Window* window, SDL_GLContext context)
   SDL_Quit();
 }
 
-SDL_AudioDeviceID create_audio()
+// returns the audio device and its sample rate
+std::tuple<SDL_AudioDeviceID, int> create_audio()
 {
   SDL_AudioSpec desired{};
   SDL_AudioSpec obtained{};
 
-  //desired.freq = 44100;
-  desired.freq = 88200;
+  desired.freq = 48000;
   desired.format = AUDIO_F32;
   desired.channels = 1;
   desired.callback = nullptr;
 
-  SDL_AudioDeviceID result = SDL_OpenAudioDevice(nullptr, 0, &desired, &obtained, 0);
+  // accept the device's native rate so that SDL doesn't resample behind our back
+  SDL_AudioDeviceID result = SDL_OpenAudioDevice(nullptr, 0, &desired, &obtained, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
   if(result == 0)
   {
     throw std::runtime_error(fmt::format("create_audio: Couldn't open audio device: {}", SDL_GetError()));
@@ -512,7 +517,7 @@ SDL_AudioDeviceID create_audio()
   // unpause the audio
   SDL_PauseAudioDevice(result, 0);
 
-  return result;
+  return {result, obtained.freq};
 }
 
 void destroy_audio(SDL_AudioDeviceID audio)
@@ -543,7 +548,15 @@ int gui(nes::system& sys)
 {
   auto [glsl_version, window, gl_context] = create_window();
 
-  SDL_AudioDeviceID audio = create_audio();
+  SDL_AudioDeviceID audio;
+  int audio_sample_rate;
+  std::tie(audio, audio_sample_rate) = create_audio();
+  sys.apu().set_sample_rate(audio_sample_rate);
+
+  // audio is filtered like the nes's analog output unless unchecked
+  std::atomic<bool> filter_audio = true;
+  nes::analog_filter audio_filter{double(audio_sample_rate)};
+  std::vector<float> filtered_samples;
 
   // Setup Dear ImGui context
   IMGUI_CHECKVERSION();
@@ -614,30 +627,26 @@ int gui(nes::system& sys)
         {
           //emulate(sys, emulation_cancelled, emulation_paused, null_stream, std::cerr);
           //emulate(sys, emulation_cancelled, emulation_paused, std::cout, std::cerr);
-          emulate(sys, emulation_cancelled, emulation_paused, std::cout, std::cerr, [audio](float sample)
+          emulate(sys, emulation_cancelled, emulation_paused, std::cout, std::cerr, [&](std::span<const float> samples)
           {
-            if(SDL_QueueAudio(audio, &sample, sizeof(float)))
+            if(filter_audio)
+            {
+              filtered_samples.assign(samples.begin(), samples.end());
+              audio_filter.process(filtered_samples);
+              samples = filtered_samples;
+            }
+
+            if(SDL_QueueAudio(audio, samples.data(), sizeof(float) * samples.size()))
             {
               throw std::runtime_error(fmt::format("gui: Error after SDL_QueueAudio: {}", SDL_GetError()));
             }
-            //// XXX it's not clear if buffering here is helpful
-            //static std::vector<float> buffer;
-            //if(buffer.capacity() == 0)
-            //{
-            //  buffer.resize(512);
-            //}
-
-            //buffer.push_back(sample);
-
-            //if(buffer.size() == buffer.capacity())
-            //{
-            //  if(SDL_QueueAudio(audio, buffer.data(), sizeof(float) * buffer.size()))
-            //  {
-            //    throw std::runtime_error(fmt::format("gui: Error after SDL_QueueAudio: {}", SDL_GetError()));
-            //  }
-
-            //  buffer.clear();
-            //}
+
+            // emulation is paced by the system clock, which drifts relative to the audio device's clock
+            // nudge the sample rate to keep about 50 ms of audio queued
+            double target = 0.05 * audio_sample_rate;
+            double queued = SDL_GetQueuedAudioSize(audio) / sizeof(float);
+            double adjustment = std::clamp((target - queued) / target, -1.0, 1.0);
+            sys.apu().set_sample_rate_adjustment(1 + 0.005 * adjustment);
           });
         });
       }
@@ -651,6 +660,12 @@ int gui(nes::system& sys)
         emulation_paused.notify_all();
       }
     }
+
+    bool filter = filter_audio;
+    if(ImGui::Checkbox("Filter audio", &filter))
+    {
+      filter_audio = filter;
+    }
     ImGui::End();
 
     // show a log window
@@ -1,25 +1,69 @@
+#include "nes/capture.hpp"
 #include "nes/emulate.hpp"
 #include "nes/system.hpp"
 #include <fmt/format.h>
+#include <limits>
+#include <optional>
+#include <string>
+#include <vector>
 
 
 int main(int argc, const char** argv)
 {
-  if(argc != 2)
+  // options may appear anywhere among the positional arguments
+  std::vector<std::string> args;
+  bool filter_audio = false;
+  for(int i = 1; i < argc; ++i)
   {
-    fmt::print("usage: {} filename\n", argv[0]);
+    std::string arg = argv[i];
+    if(arg == "--filter-audio")
+    {
+      filter_audio = true;
+    }
+    else
+    {
+      args.push_back(arg);
+    }
+  }
+
+  if(args.size() < 1 or args.size() > 5)
+  {
+    fmt::print("usage: {} [--filter-audio] filename [num_frames [video_filename [audio_filename [sample_rate]]]]\n", argv[0]);
+    fmt::print("  video is recorded as y4m, a sequence of ppm files, or raw rgb according to the extension of video_filename\n");
+    fmt::print("  audio is recorded as wav at sample_rate, which is {} by default\n", nes::apu::default_sample_rate);
+    fmt::print("  audio is recorded exactly as the apu produced it, or as the nes's output sounds with --filter-audio\n");
     return 0;
   }
 
+  std::size_t num_frames = args.size() > 1 ? std::stoul(args[1]) : std::numeric_limits<std::size_t>::max();
+
   // create a system
-  nes::system sys{argv[1]};
+  // battery-backed ram isn't saved, so each run starts from the same state and its recordings are reproducible
+  nes::system sys{nes::rom_image::open(args[0])};
+
+  // record video and audio if requested
+  std::optional<nes::capture> capture;
+  if(args.size() > 2)
+  {
+    nes::capture::options opts;
+    opts.video_filename = args[2];
+    opts.video = nes::capture::video_format_for(opts.video_filename);
+    if(args.size() > 3) opts.audio_filename = args[3];
+    if(args.size() > 4) opts.audio_sample_rate = std::stoi(args[4]);
+    opts.filter_audio = filter_audio;
+
+    sys.apu().set_sample_rate(opts.audio_sample_rate);
+
+    capture.emplace(opts);
+    sys.attach_capture(*capture);
+  }
 
   //sys.bus().write(cpu::reset_vector_location + 0, 0x00);
   //sys.bus().write(cpu::reset_vector_location + 1, 0xC0);
 
   try
   {
-    emulate(sys);
+    emulate(sys, num_frames);
   }
   catch(std::exception& e)
   {
@@ -36,6 +80,19 @@ int main(int argc, const char** argv)
     }
   }
 
+  if(capture)
+  {
+    capture->close();
+    fmt::print(stderr, "captured {} frames ({} dropped) and {} audio samples ({} dropped)\n",
+      capture->num_frames_written(), capture->num_frames_dropped(),
+      capture->num_audio_samples_written(), capture->num_audio_samples_dropped());
+
+    if(not capture->error().empty())
+    {
+      fmt::print(stderr, "{}\n", capture->error());
+    }
+  }
+
   return 0;
 }
 
@@ -0,0 +1,160 @@
+#include "nes/cartridge.hpp"
+#include <chrono>
+#include <cstdint>
+#include <fmt/format.h>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+// returns an iNES image with the given mapper and sizes, whose memory is filled with noise
+std::string make_rom_image(int mapper_id, int num_prg_rom_chunks, int num_chr_rom_chunks)
+{
+  std::string result{"NES\x1A", 4};
+  result.push_back(num_prg_rom_chunks);
+  result.push_back(num_chr_rom_chunks);
+  result.push_back((mapper_id & 0x0F) << 4);
+  result.push_back(mapper_id & 0xF0);
+  result.resize(16);
+
+  std::mt19937 rng{1234};
+  std::size_t size = num_prg_rom_chunks * 16384 + num_chr_rom_chunks * 8192;
+  for(std::size_t i = 0; i < size; ++i)
+  {
+    result.push_back(rng());
+  }
+
+  return result;
+}
+
+
+// what is read gets stored here so that the reads aren't optimized away
+volatile unsigned int sink;
+
+
+// returns the average number of nanoseconds taken by each of num_iterations calls to f
+double measure(std::size_t num_iterations, std::function<void(std::size_t)> f)
+{
+  auto start = std::chrono::steady_clock::now();
+  f(num_iterations);
+  std::chrono::duration<double,std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / num_iterations;
+}
+
+
+struct benchmark
+{
+  const char* name;
+  int mapper_id;
+  int num_prg_rom_chunks;
+  int num_chr_rom_chunks;
+
+  // a write sequence which switches banks, as games do
+  std::function<void(nes::cartridge&, std::uint8_t bank)> switch_banks;
+};
+
+
+int main(int argc, const char** argv)
+{
+  if(argc > 2)
+  {
+    fmt::print("usage: {} [num_iterations]\n", argv[0]);
+    fmt::print("  measures the cost of reads and bank switches through each mapper\n");
+    return 0;
+  }
+
+  try
+  {
+    std::size_t num_iterations = argc > 1 ? std::stoull(argv[1]) : 1 << 26;
+
+    std::vector<benchmark> benchmarks = {
+      {"NROM", 0, 2, 1, [](nes::cartridge&, std::uint8_t)
+      {
+      }},
+      {"MMC1", 1, 16, 16, [](nes::cartridge& cart, std::uint8_t bank)
+      {
+        // registers are written one bit at a time
+        for(int i = 0; i < 5; ++i)
+        {
+          cart.write(0xE000, bank >> i);
+        }
+      }},
+      {"UxROM", 2, 16, 0, [](nes::cartridge& cart, std::uint8_t bank)
+      {
+        cart.write(0x8000, bank);
+      }},
+      {"CNROM", 3, 2, 4, [](nes::cartridge& cart, std::uint8_t bank)
+      {
+        cart.write(0x8000, bank);
+      }},
+      {"MMC3", 4, 32, 32, [](nes::cartridge& cart, std::uint8_t bank)
+      {
+        cart.write(0x8000, 6);
+        cart.write(0x8001, bank);
+        cart.write(0x8000, 2);
+        cart.write(0x8001, bank);
+      }},
+      {"AxROM", 7, 16, 0, [](nes::cartridge& cart, std::uint8_t bank)
+      {
+        cart.write(0x8000, bank);
+      }},
+    };
+
+    // the same addresses are used for each mapper, and are generated up front so that generating them isn't measured
+    std::vector<std::uint16_t> cpu_addresses(4096);
+    std::vector<std::uint16_t> ppu_addresses(4096);
+    std::mt19937 rng{5678};
+    for(std::size_t i = 0; i < cpu_addresses.size(); ++i)
+    {
+      cpu_addresses[i] = 0x8000 | (rng() & 0x7FFF);
+      ppu_addresses[i] = rng() & 0x1FFF;
+    }
+
+    fmt::print("{:8} {:>12} {:>12} {:>12}\n", "mapper", "read ns", "chr read ns", "switch ns");
+
+    for(const benchmark& b: benchmarks)
+    {
+      nes::cartridge cart{std::istringstream{make_rom_image(b.mapper_id, b.num_prg_rom_chunks, b.num_chr_rom_chunks)}};
+
+      unsigned int sum = 0;
+
+      double read_ns = measure(num_iterations, [&](std::size_t n)
+      {
+        for(std::size_t i = 0; i < n; ++i)
+        {
+          sum += cart.read(cpu_addresses[i & (cpu_addresses.size() - 1)]);
+        }
+      });
+
+      double graphics_read_ns = measure(num_iterations, [&](std::size_t n)
+      {
+        for(std::size_t i = 0; i < n; ++i)
+        {
+          sum += cart.graphics_read(ppu_addresses[i & (ppu_addresses.size() - 1)]);
+        }
+      });
+
+      double switch_ns = measure(num_iterations / 16, [&](std::size_t n)
+      {
+        for(std::size_t i = 0; i < n; ++i)
+        {
+          b.switch_banks(cart, i);
+        }
+      });
+
+      sink = sum;
+
+      fmt::print("{:8} {:12.3f} {:12.3f} {:12.3f}\n", b.name, read_ns, graphics_read_ns, switch_ns);
+    }
+  }
+  catch(std::exception& e)
+  {
+    std::cerr << "Caught exception: " << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -1,7 +1,15 @@
 #pragma once
 
+#include "band_limited_buffer.hpp"
+#include <algorithm>
+#include <array>
 #include <cassert>
 #include <cstdint>
+#include <fmt/format.h>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <vector>
 
 
 namespace nes
@@ -99,6 +107,21 @@ class timer
       return result;
     }
 
+    // clocks the timer n times and returns the number of those clocks which produced a signal
+    inline std::size_t clock(std::size_t n)
+    {
+      if(n <= value_)
+      {
+        value_ -= n;
+        return 0;
+      }
+
+      // the first signal happens on clock value_ + 1, and then one every period_ + 1 clocks
+      std::size_t remaining = n - value_ - 1;
+      value_ = period_ - remaining % (period_ + 1);
+      return 1 + remaining / (period_ + 1);
+    }
+
   private:
     // note that the timer's period is actually 1 + period_, because the clock() function's signal happens with a delay of one clock cycle
     std::uint16_t period_;
@@ -346,6 +369,11 @@ class pulse_wave
       step_ %= 8;
     }
 
+    inline void clock(std::size_t n)
+    {
+      step_ = (step_ + n) % 8;
+    }
+
     inline bool value() const
     {
       // see https://www.nesdev.org/wiki/APU_Pulse#Sequencer_behavior,
@@ -370,7 +398,7 @@ class pulse_channel
 {
   public:
     inline pulse_channel(bool is_channel_0)
-      : timer_{}, volume_envelope_{}, sequencer_{}, length_counter_{}, sweep_{timer_, is_channel_0}
+      : timer_{}, volume_envelope_{}, sequencer_{}, length_counter_{}, sweep_{timer_, is_channel_0}, num_deferred_clocks_{0}
     {}
 
     inline bool length_counter_status() const
@@ -387,6 +415,8 @@ class pulse_channel
 
     inline void set_length_counter_and_timer_high_bits(std::uint8_t table_index, std::uint8_t timer_bits)
     {
+      catch_up();
+
       length_counter_.maybe_set_value_from_lookup_table(table_index);
       timer_.set_high_three_bits_of_period(timer_bits);
 
@@ -396,6 +426,8 @@ class pulse_channel
 
     inline void set_timer_low_bits(std::uint8_t timer_bits)
     {
+      catch_up();
+
       timer_.set_low_eight_bits_of_period(timer_bits);
     }
 
@@ -409,16 +441,30 @@ class pulse_channel
       length_counter_.enable(enabled);
     }
 
-    inline void clock()
+    // returns whether the channel's output may have changed
+    inline bool clock()
     {
+      // while the length counter is 0, the channel is silent, so its timer and sequencer can wait until it might be heard
+      if(not length_counter_.value())
+      {
+        ++num_deferred_clocks_;
+        return false;
+      }
+
       if(timer_.clock())
       {
         sequencer_.clock();
+        return true;
       }
+
+      return false;
     }
 
     inline void clock_half_frame_signals()
     {
+      // the sweep may change the timer's period
+      catch_up();
+
       length_counter_.clock();
       sweep_.clock();
     }
@@ -434,11 +480,23 @@ class pulse_channel
     }
 
   private:
+    // brings the timer and sequencer up to date with the clocks deferred while the channel was silent
+    // this must happen before anything which changes the timer's period, the sequencer, or the length counter
+    inline void catch_up()
+    {
+      if(num_deferred_clocks_)
+      {
+        sequencer_.clock(timer_.clock(num_deferred_clocks_));
+        num_deferred_clocks_ = 0;
+      }
+    }
+
     timer timer_;
     volume_envelope volume_envelope_;
     pulse_wave sequencer_;
     length_counter length_counter_;
     sweep sweep_;
+    std::size_t num_deferred_clocks_;
 };
 
 
@@ -529,6 +587,10 @@ class triangle_wave
 class triangle_channel
 {
   public:
+    inline triangle_channel()
+      : timer_{}, linear_counter_{}, length_counter_{}, sequencer_{}, num_deferred_clocks_{0}
+    {}
+
     inline void enable(bool enabled)
     {
       length_counter_.enable(enabled);
@@ -547,6 +609,8 @@ class triangle_channel
 
     inline void set_length_counter_and_timer_high_bits(std::uint8_t table_index, std::uint8_t timer_bits)
     {
+      catch_up();
+
       length_counter_.maybe_set_value_from_lookup_table(table_index);
       timer_.set_high_three_bits_of_period(timer_bits);
 
@@ -555,18 +619,31 @@ class triangle_channel
 
     inline void set_timer_low_bits(std::uint8_t timer_bits)
     {
+      catch_up();
+
       timer_.set_low_eight_bits_of_period(timer_bits);
     }
 
-    inline void clock()
+    // returns whether the channel's output may have changed
+    inline bool clock()
     {
       // see https://www.nesdev.org/wiki/APU_Triangle
       // "The sequencer is clocked by the timer as long as both the linear
       // counter and the length counter are nonzero."
-      if(timer_.clock() and linear_counter_.value() and length_counter_.value())
+      // otherwise, only the timer runs, so its clocks can wait until the sequencer might run again
+      if(not linear_counter_.value() or not length_counter_.value())
+      {
+        ++num_deferred_clocks_;
+        return false;
+      }
+
+      if(timer_.clock())
       {
         sequencer_.clock();
+        return true;
       }
+
+      return false;
     }
 
     inline void clock_half_frame_signals()
@@ -576,6 +653,9 @@ class triangle_channel
 
     inline void clock_quarter_frame_signals()
     {
+      // the linear counter may be reloaded
+      catch_up();
+
       linear_counter_.clock();
     }
 
@@ -589,10 +669,22 @@ class triangle_channel
     }
 
   private:
+    // brings the timer up to date with the clocks deferred while the sequencer was halted
+    // this must happen before anything which changes the timer's period, the linear counter, or the length counter
+    inline void catch_up()
+    {
+      if(num_deferred_clocks_)
+      {
+        timer_.clock(num_deferred_clocks_);
+        num_deferred_clocks_ = 0;
+      }
+    }
+
     timer timer_;
     linear_counter linear_counter_;
     length_counter length_counter_;
     triangle_wave sequencer_;
+    std::size_t num_deferred_clocks_;
 };
 
 
@@ -625,6 +717,17 @@ class linear_feedback_shift_register
       value_ |= (feedback << 14);
     }
 
+    inline void clock(std::size_t n)
+    {
+      // the register's sequence repeats every 32767 clocks in mode 0, and every 93 (or 31, which divides 93) in mode 1
+      n %= mode_ ? 93 : 32767;
+
+      for(std::size_t i = 0; i < n; ++i)
+      {
+        clock();
+      }
+    }
+
     inline bool value() const
     {
       bool bit_0 = (value_ & 0b1) != 0;
@@ -641,6 +744,10 @@ class linear_feedback_shift_register
 class noise_channel
 {
   public:
+    inline noise_channel()
+      : timer_{}, shift_register_{}, length_counter_{}, volume_envelope_{}, num_deferred_clocks_{0}
+    {}
+
     inline void enable(bool enabled)
     {
       length_counter_.enable(enabled);
@@ -661,6 +768,8 @@ class noise_channel
     {
       assert(index < 16);
 
+      catch_up();
+
       shift_register_.set_mode(mode);
 
       constexpr std::uint16_t period[] =
@@ -673,16 +782,29 @@ class noise_channel
 
     inline void set_length_counter(std::uint8_t index)
     {
+      catch_up();
+
       length_counter_.maybe_set_value_from_lookup_table(index);
       volume_envelope_.reset();
     }
 
-    inline void clock()
+    // returns whether the channel's output may have changed
+    inline bool clock()
     {
+      // while the length counter is 0, the channel is silent, so its timer and shift register can wait until it might be heard
+      if(not length_counter_.value())
+      {
+        ++num_deferred_clocks_;
+        return false;
+      }
+
       if(timer_.clock())
       {
         shift_register_.clock();
+        return true;
       }
+
+      return false;
     }
 
     inline void clock_half_frame_signals()
@@ -701,10 +823,22 @@ class noise_channel
     }
 
   private:
+    // brings the timer and shift register up to date with the clocks deferred while the channel was silent
+    // this must happen before anything which changes the timer's period, the shift register's mode, or the length counter
+    inline void catch_up()
+    {
+      if(num_deferred_clocks_)
+      {
+        shift_register_.clock(timer_.clock(num_deferred_clocks_));
+        num_deferred_clocks_ = 0;
+      }
+    }
+
     timer timer_;
     linear_feedback_shift_register shift_register_;
     length_counter length_counter_;
     volume_envelope volume_envelope_;
+    std::size_t num_deferred_clocks_;
 };
 
 
@@ -713,9 +847,12 @@ class frame_counter
   public:
     inline frame_counter(pulse_channel& pulse_0, pulse_channel& pulse_1, triangle_channel& triangle, noise_channel& noise)
       : frame_interrupt_flag_{false},
-        in_five_step_mode_{false},
         inhibit_interrupts_{false},
+        sequence_{&four_step_sequence},
+        next_event_{0},
         num_cpu_cycles_{0},
+        sequence_start_cycle_{0},
+        next_event_cycle_{to_cpu_cycles(four_step_sequence.events[0].apu_cycle)},
         pulse_0_{pulse_0},
         pulse_1_{pulse_1},
         triangle_{triangle},
@@ -723,24 +860,33 @@ class frame_counter
     {}
 
     // this gets called once each CPU cycle
-    inline void clock()
+    // nothing happens except on the few cycles of each sequence which have an event
+    // returns whether an event happened
+    inline bool clock()
     {
-      if(in_five_step_mode_)
-      {
-        five_step_mode_clock();
-      }
-      else
+      bool result = num_cpu_cycles_ == next_event_cycle_;
+
+      if(result)
       {
-        four_step_mode_clock();
+        run_next_event();
       }
+
+      ++num_cpu_cycles_;
+
+      return result;
+    }
+
+    // the number of calls to clock() before the next one which does something
+    inline std::size_t num_cpu_cycles_until_next_event() const
+    {
+      return next_event_cycle_ - num_cpu_cycles_;
     }
 
     void set(bool five_step_mode, bool inhibit_interrupts)
     {
-      in_five_step_mode_ = five_step_mode;
       inhibit_interrupts_ = inhibit_interrupts;
 
-      if(in_five_step_mode_)
+      if(five_step_mode)
       {
         // see https://www.nesdev.org/wiki/APU_Frame_Counter
         // "if the mode flag is set (i.e. if in five step mode), then both quarter frame and half frame signals are also generated
@@ -748,8 +894,12 @@ class frame_counter
         clock_half_frame_signals();
       }
 
-      // the counter is also reset
+      // the counter is also reset, so the schedule starts over in the new mode
+      sequence_ = five_step_mode ? &five_step_sequence : &four_step_sequence;
+      next_event_ = 0;
       num_cpu_cycles_ = 0;
+      sequence_start_cycle_ = 0;
+      next_event_cycle_ = to_cpu_cycles(sequence_->events[0].apu_cycle);
     }
 
     inline bool frame_interrupt_flag()
@@ -781,93 +931,91 @@ class frame_counter
       return 2 * value;
     }
 
-    inline void four_step_mode_clock()
+    struct event
     {
-      // see https://www.nesdev.org/wiki/APU_Frame_Counter table Mode 0
-      switch(num_cpu_cycles_)
-      {
-        case to_cpu_cycles(3728.5):
-        case to_cpu_cycles(11185.5):
-        {
-          clock_quarter_frame_signals();
-          break;
-        }
+      // the event's time in apu cycles, as listed by the table it comes from
+      double apu_cycle;
+      bool quarter_frame;
+      bool half_frame;
+      bool interrupt;
+    };
 
-        case to_cpu_cycles(7456.5):
-        {
-          clock_quarter_frame_signals();
-          clock_half_frame_signals();
-          break;
-        }
+    struct sequence
+    {
+      std::array<event,6> events;
+      std::size_t num_events;
 
-        case to_cpu_cycles(14914):
-        case to_cpu_cycles(14915):
-        {
-          if(not inhibit_interrupts_)
-          {
-            frame_interrupt_flag_ = true;
-          }
+      // the number of apu cycles before the sequence repeats
+      double period;
+    };
 
-          break;
-        }
+    // see https://www.nesdev.org/wiki/APU_Frame_Counter table Mode 0
+    constexpr static sequence four_step_sequence
+    {
+      {{
+        {3728.5,  true,  false, false},
+        {7456.5,  true,  true,  false},
+        {11185.5, true,  false, false},
+        {14914,   false, false, true},
+        {14914.5, true,  true,  true},
+        {14915,   false, false, true}
+      }},
+      6,
+      14915.5
+    };
 
-        case to_cpu_cycles(14914.5):
-        {
-          clock_quarter_frame_signals();
-          clock_half_frame_signals();
-          
-          if(not inhibit_interrupts_)
-          {
-            frame_interrupt_flag_ = true;
-          }
+    // see https://www.nesdev.org/wiki/APU_Frame_Counter table Mode 1
+    constexpr static sequence five_step_sequence
+    {
+      {{
+        {3728.5,  true,  false, false},
+        {7456.5,  true,  true,  false},
+        {11185.5, true,  false, false},
+        {18640.5, true,  true,  false}
+      }},
+      4,
+      18641.5
+    };
 
-          break;
-        }
+    inline void run_next_event()
+    {
+      const event& e = sequence_->events[next_event_];
 
-        default:
-        {
-          // do nothing
-          break;
-        }
+      if(e.quarter_frame)
+      {
+        clock_quarter_frame_signals();
       }
 
-      num_cpu_cycles_ = (num_cpu_cycles_ == to_cpu_cycles(14915)) ? 0 : num_cpu_cycles_ + 1;
-    }
-
-    inline void five_step_mode_clock()
-    {
-      // see https://www.nesdev.org/wiki/APU_Frame_Counter table Mode 1
-      switch(num_cpu_cycles_)
+      if(e.half_frame)
       {
-        case to_cpu_cycles(3728.5):
-        case to_cpu_cycles(11185.5):
-        {
-          clock_quarter_frame_signals();
-          break;
-        }
+        clock_half_frame_signals();
+      }
 
-        case to_cpu_cycles(7456.5):
-        case to_cpu_cycles(18640.5):
-        {
-          clock_quarter_frame_signals();
-          clock_half_frame_signals();
-          break;
-        }
+      if(e.interrupt and not inhibit_interrupts_)
+      {
+        frame_interrupt_flag_ = true;
+      }
 
-        default:
-        {
-          // do nothing
-          break;
-        }
+      // schedule the following event, which may be in the next repetition of the sequence
+      if(++next_event_ == sequence_->num_events)
+      {
+        next_event_ = 0;
+        sequence_start_cycle_ += to_cpu_cycles(sequence_->period);
       }
 
-      num_cpu_cycles_ = (num_cpu_cycles_ == to_cpu_cycles(18641)) ? 0 : num_cpu_cycles_ + 1;
+      next_event_cycle_ = sequence_start_cycle_ + to_cpu_cycles(sequence_->events[next_event_].apu_cycle);
     }
 
     bool frame_interrupt_flag_;
-    bool in_five_step_mode_;
     bool inhibit_interrupts_;
+    const sequence* sequence_;
+    std::size_t next_event_;
+
+    // cycles are counted from the most recent call to set()
     std::size_t num_cpu_cycles_;
+    std::size_t sequence_start_cycle_;
+    std::size_t next_event_cycle_;
+
     pulse_channel& pulse_0_;
     pulse_channel& pulse_1_;
     triangle_channel& triangle_;
@@ -875,37 +1023,496 @@ class frame_counter
 };
 
 
+// see https://www.nesdev.org/wiki/APU_Mixer#Lookup_Table
+class mixer
+{
+  public:
+    // pulse_table[n] is the output of the pulse channels when the sum of their levels is n
+    constexpr static std::array<float,31> pulse_table = []
+    {
+      std::array<float,31> result{};
+
+      for(int n = 1; n < 31; ++n)
+      {
+        result[n] = 95.52f / (8128.f / n + 100.f);
+      }
+
+      return result;
+    }();
+
+    // tnd_table[n] is the output of the triangle, noise, and dmc channels when 3 * triangle + 2 * noise + dmc is n
+    constexpr static std::array<float,203> tnd_table = []
+    {
+      std::array<float,203> result{};
+
+      for(int n = 1; n < 203; ++n)
+      {
+        result[n] = 163.67f / (24329.f / n + 100.f);
+      }
+
+      return result;
+    }();
+
+    struct channel_gains
+    {
+      float pulse_0  = 1;
+      float pulse_1  = 1;
+      float triangle = 1;
+      float noise    = 1;
+      float dmc      = 1;
+    };
+
+    inline mixer()
+      : unity_gains_{true},
+        weights_{1, 1, 3, 2, 1},
+        level_masks_{0xFF, 0xFF, 0xFF, 0xFF, 0xFF}
+    {}
+
+    // a channel with a gain of 0 is left out of the mix entirely, as though its level were 0,
+    // so it doesn't affect the compression of the other channels in its group either
+    inline void set_gains(const channel_gains& gains)
+    {
+      unity_gains_ = gains.pulse_0 == 1 and gains.pulse_1 == 1 and gains.triangle == 1 and gains.noise == 1 and gains.dmc == 1;
+      weights_ = {gains.pulse_0, gains.pulse_1, 3 * gains.triangle, 2 * gains.noise, gains.dmc};
+
+      for(int i = 0; i < 5; ++i)
+      {
+        level_masks_[i] = weights_[i] == 0 ? 0 : 0xFF;
+      }
+    }
+
+    inline float mix(std::uint8_t pulse_0, std::uint8_t pulse_1, std::uint8_t triangle, std::uint8_t noise, std::uint8_t dmc) const
+    {
+      assert(pulse_0 < 16 and pulse_1 < 16 and triangle < 16 and noise < 16 and dmc < 128);
+
+      int pulse_index = pulse_0 + pulse_1;
+      int tnd_index = 3 * triangle + 2 * noise + dmc;
+
+      if(unity_gains_)
+      {
+        return pulse_table[pulse_index] + tnd_table[tnd_index];
+      }
+
+      // otherwise, the tables supply the compression of each group's combined level,
+      // and each channel contributes in proportion to its gain
+      // channels with a gain of 0 don't count towards their group's level
+      pulse_0 &= level_masks_[0];
+      pulse_1 &= level_masks_[1];
+      triangle &= level_masks_[2];
+      noise &= level_masks_[3];
+      dmc &= level_masks_[4];
+      pulse_index = pulse_0 + pulse_1;
+      tnd_index = 3 * triangle + 2 * noise + dmc;
+
+      float pulse = pulse_table_per_level[pulse_index] * (weights_[0] * pulse_0 + weights_[1] * pulse_1);
+      float tnd = tnd_table_per_level[tnd_index] * (weights_[2] * triangle + weights_[3] * noise + weights_[4] * dmc);
+
+      return pulse + tnd;
+    }
+
+  private:
+    // each entry of the tables divided by its index
+    constexpr static std::array<float,31> pulse_table_per_level = []
+    {
+      std::array<float,31> result = pulse_table;
+
+      for(int n = 1; n < 31; ++n)
+      {
+        result[n] /= n;
+      }
+
+      return result;
+    }();
+
+    constexpr static std::array<float,203> tnd_table_per_level = []
+    {
+      std::array<float,203> result = tnd_table;
+
+      for(int n = 1; n < 203; ++n)
+      {
+        result[n] /= n;
+      }
+
+      return result;
+    }();
+
+    bool unity_gains_;
+    std::array<float,5> weights_;
+    std::array<std::uint8_t,5> level_masks_;
+};
+
+
 class apu
 {
   public:
+    // see https://www.nesdev.org/wiki/Cycle_reference_chart
+    constexpr static double cpu_clock_rate = 236.25e6 / 11 / 12;
+
+    constexpr static double default_sample_rate = 88200;
+
+    enum channel
+    {
+      pulse_0, pulse_1, triangle, noise, dmc
+    };
+
+    constexpr static int num_channels = 5;
+
     inline apu()
       : is_odd_cpu_clock_{false},
         pulse_0_{true},
         pulse_1_{false},
         triangle_{},
         noise_{},
-        frame_counter_{pulse_0_, pulse_1_, triangle_, noise_}
+        frame_counter_{pulse_0_, pulse_1_, triangle_, noise_},
+        mixer_{},
+        output_{cpu_clock_rate, default_sample_rate, max_num_buffered_samples},
+        sample_rate_{default_sample_rate},
+        sample_rate_adjustment_{1},
+        num_output_cycles_{0},
+        channel_levels_{0},
+        output_level_{0},
+        levels_need_checking_{true},
+        synthesis_enabled_{true},
+        muted_channels_{},
+        soloed_channels_{},
+        audible_levels_{0xFFFF},
+        channel_outputs_{}
     {}
 
+    // audio samples are produced at this rate, e.g. 44100, 48000, or 96000
+    inline void set_sample_rate(double sample_rate)
+    {
+      assert(0 < sample_rate and sample_rate <= max_sample_rate);
+
+      sample_rate_ = sample_rate;
+      update_output_rate();
+    }
+
+    inline double sample_rate() const
+    {
+      return sample_rate_;
+    }
+
+    // scales the sample rate by a ratio close to 1 without otherwise changing the output
+    // a consumer which plays samples in real time can use this to keep its queue of samples from running dry or growing,
+    // e.g. 1.001 produces 0.1% more samples per emulated second
+    inline void set_sample_rate_adjustment(double ratio)
+    {
+      assert(0.9 < ratio and ratio < 1.1);
+
+      sample_rate_adjustment_ = ratio;
+      update_output_rate();
+    }
+
+    // reads at most samples.size() audio samples synthesized since the previous call and returns the number read
+    // samples which are not read in time are discarded once several seconds of them have accumulated
+    inline std::size_t read_samples(std::span<float> samples)
+    {
+      end_output_frame();
+      return output_.read_samples(samples);
+    }
+
+    // emulates the given number of cpu cycles and writes the audio samples synthesized so far to samples
+    // returns the number of samples written
+    inline std::size_t render(std::span<float> samples, std::size_t num_cycles)
+    {
+      for(std::size_t i = 0; i < num_cycles; ++i)
+      {
+        step_cycle();
+      }
+
+      return read_samples(samples);
+    }
+
     inline void step_cycle()
     {
       // the frame counter gets clocked every cpu clock
-      frame_counter_.clock();
+      // its signals may change the channels' levels
+      bool levels_may_have_changed = frame_counter_.clock();
 
-      // so does the triangle
-      triangle_.clock();
-
-      // other channels clock every other cpu clock
-      if(is_odd_cpu_clock_)
+      if(synthesis_enabled_)
       {
-        pulse_0_.clock();
-        pulse_1_.clock();
-        noise_.clock();
+        // so does the triangle
+        levels_may_have_changed |= triangle_.clock();
+
+        // other channels clock every other cpu clock
+        if(is_odd_cpu_clock_)
+        {
+          levels_may_have_changed |= pulse_0_.clock();
+          levels_may_have_changed |= pulse_1_.clock();
+          levels_may_have_changed |= noise_.clock();
+        }
+
+        // on most cycles, no channel does anything, so there's no need to look at their levels
+        if(levels_may_have_changed or levels_need_checking_)
+        {
+          maybe_add_output_step();
+          levels_need_checking_ = false;
+        }
       }
 
       is_odd_cpu_clock_ = !is_odd_cpu_clock_;
+
+      advance_output_cycle();
+    }
+
+    // while synthesis is disabled, the apu emulates only what the cpu can observe: the length counters and the frame interrupt
+    // the channels' timers, sequencers, and shift register stand still, and the output is silent
+    // this is much cheaper for runs which don't need sound
+    inline void enable_synthesis(bool enable)
+    {
+      if(synthesis_enabled_ == enable) return;
+
+      synthesis_enabled_ = enable;
+      levels_need_checking_ = true;
+
+      // fade to or from silence with a single step
+      update_output_level(synthesis_enabled_ ? sample() : 0);
+
+      if(channel_outputs_)
+      {
+        update_channel_outputs(synthesis_enabled_ ? channel_levels() : 0);
+      }
+    }
+
+    inline bool synthesis_enabled() const
+    {
+      return synthesis_enabled_;
+    }
+
+    // reads the status register at $4015
+    // see https://www.nesdev.org/wiki/APU#Status_($4015)
+    inline std::uint8_t read_status_register()
+    {
+      bool dmc_interrupt = false;
+      bool frame_interrupt = frame_counter_.frame_interrupt_flag();
+      bool dmc_active = false;
+      bool noise_length_counter_status = false;
+      bool triangle_length_counter_status = triangle_.length_counter_status();
+      bool pulse_1_length_counter_status = pulse_1_.length_counter_status();
+      bool pulse_0_length_counter_status = pulse_0_.length_counter_status();
+
+      std::uint8_t result = 0;
+      result |= (dmc_interrupt << 7);
+      result |= (frame_interrupt << 6);
+      result |= (dmc_active << 4);
+      result |= (noise_length_counter_status << 3);
+      result |= (triangle_length_counter_status << 2);
+      result |= (pulse_1_length_counter_status << 1);
+      result |= (pulse_0_length_counter_status << 0);
+
+      return result;
+    }
+
+    // writes one of the registers $4000-$4013, $4015, or $4017
+    // see https://www.nesdev.org/wiki/APU_registers
+    inline void write_register(std::uint16_t address, std::uint8_t value)
+    {
+      levels_need_checking_ = true;
+
+      if(0x4000 == address)
+      {
+        std::uint8_t duty_cycle = value >> 6;
+        bool loop_volume = (0b00100000 & value) != 0;
+        bool constant_volume = (0b00010000 & value) != 0;
+        std::uint8_t volume_period = 0b00001111 & value;
+
+        set_pulse_0_duty_cycle_and_volume_envelope(duty_cycle, loop_volume, constant_volume, volume_period);
+      }
+      else if(0x4001 == address)
+      {
+        bool enabled             = (0b10000000 & value) != 0;
+        std::uint8_t period      = (0b01110000 & value) >> 4;
+        bool negated             = (0b00001000 & value) != 0;
+        std::uint8_t shift_count =  0b00000111 & value;
+
+        set_pulse_0_sweep(enabled, period, negated, shift_count);
+      }
+      else if(0x4002 == address)
+      {
+        set_pulse_0_timer_low_bits(value);
+      }
+      else if(0x4003 == address)
+      {
+        std::uint8_t index = value >> 3;
+        std::uint8_t timer_bits = (0b00000111 & value);
+
+        set_pulse_0_length_counter_and_timer_high_bits(index, timer_bits);
+      }
+      else if(0x4004 == address)
+      {
+        std::uint8_t duty_cycle = value >> 6;
+        bool loop_volume = (0b00100000 & value) != 0;
+        bool constant_volume = (0b00010000 & value) != 0;
+        std::uint8_t volume_period = 0b00001111 & value;
+
+        set_pulse_1_duty_cycle_and_volume_envelope(duty_cycle, loop_volume, constant_volume, volume_period);
+      }
+      else if(0x4005 == address)
+      {
+        bool enabled             = (0b10000000 & value) != 0;
+        std::uint8_t period      = (0b01110000 & value) >> 4;
+        bool negated             = (0b00001000 & value) != 0;
+        std::uint8_t shift_count =  0b00000111 & value;
+
+        set_pulse_1_sweep(enabled, period, negated, shift_count);
+      }
+      else if(0x4006 == address)
+      {
+        set_pulse_1_timer_low_bits(value);
+      }
+      else if(0x4007 == address)
+      {
+        std::uint8_t index = value >> 3;
+        std::uint8_t timer_bits = (0b00000111 & value);
+
+        set_pulse_1_length_counter_and_timer_high_bits(index, timer_bits);
+      }
+      else if(0x4008 == address)
+      {
+        bool control        = (0b10000000 & value) != 0;
+        std::uint8_t period = (0b01111111 & value);
+
+        set_triangle_linear_counter(control, period);
+      }
+      else if(0x400A == address)
+      {
+        set_triangle_timer_low_bits(value);
+      }
+      else if(0x400B == address)
+      {
+        std::uint8_t index = value >> 3;
+        std::uint8_t timer_bits = (0b00000111 & value);
+
+        set_triangle_length_counter_and_timer_high_bits(index, timer_bits);
+      }
+      else if(0x400C == address)
+      {
+        bool halt_length_counter   = (0b00100000 & value) != 0;
+        bool constant_volume       = (0b00010000 & value) != 0;
+        std::uint8_t volume_period = (0b00001111 & value);
+
+        set_noise_length_counter_halt_and_volume_envelope(halt_length_counter, constant_volume, volume_period);
+      }
+      else if(0x400E == address)
+      {
+        bool mode          = (0b10000000 & value) != 0;
+        std::uint8_t index = (0b00001111 & value);
+
+        set_noise_mode_and_timer_period(mode, index);
+      }
+      else if(0x400F == address)
+      {
+        std::uint8_t index = value >> 3;
+
+        set_noise_length_counter(index);
+      }
+      else if(0x4009 == address or 0x400D == address)
+      {
+        // unused
+      }
+      else if(0x400F < address and address < 0x4014)
+      {
+        // the dmc isn't emulated yet
+      }
+      else if(0x4015 == address)
+      {
+        // sound channels enable
+        bool dmc_enabled      = (0b00010000 & value) != 0;
+        bool noise_enabled    = (0b00001000 & value) != 0;
+        bool triangle_enabled = (0b00000100 & value) != 0;
+        bool pulse_1_enabled  = (0b00000010 & value) != 0;
+        bool pulse_0_enabled  = (0b00000001 & value) != 0;
+
+        enable_channels(dmc_enabled, noise_enabled, triangle_enabled, pulse_1_enabled, pulse_0_enabled);
+      }
+      else if(0x4017 == address)
+      {
+        // see https://www.nesdev.org/wiki/APU#Frame_Counter_($4017)
+        bool mode               = (value & 0b10000000) != 0;
+        bool inhibit_interrupts = (value & 0b01000000) != 0;
+
+        set_frame_counter_mode_and_interrupts(mode, inhibit_interrupts);
+      }
+      else
+      {
+        throw std::runtime_error(fmt::format("apu::write_register: Bad address: {:04X}", address));
+      }
+    }
+
+    inline float sample() const
+    {
+      return mix(channel_levels());
+    }
+
+    // scales the contribution of each channel to the output
+    inline void set_channel_gains(const mixer::channel_gains& gains)
+    {
+      mixer_.set_gains(gains);
+
+      // the output changes even though no channel has
+      if(synthesis_enabled_)
+      {
+        update_output_level(sample());
+      }
     }
 
+    // a muted channel is left out of the output, as though its level were 0
+    inline void mute_channel(channel c, bool mute)
+    {
+      muted_channels_[c] = mute;
+      update_audible_channels();
+    }
+
+    // while any channels are soloed, only those channels are heard, whether or not they are muted
+    inline void solo_channel(channel c, bool solo)
+    {
+      soloed_channels_[c] = solo;
+      update_audible_channels();
+    }
+
+    // while enabled, the apu also produces a separate stream of samples for each channel
+    // each stream is the output of its channel alone, unaffected by gains, muting, or soloing
+    // the streams are sample-aligned with the output as long as each is read as much as the output is
+    inline void enable_channel_outputs(bool enable)
+    {
+      if(enable == bool(channel_outputs_)) return;
+
+      if(enable)
+      {
+        channel_outputs_ = std::make_unique<channel_outputs>();
+
+        // begin at the same point in time as the output
+        end_output_frame();
+        for(int i = 0; i < num_channels; ++i)
+        {
+          channel_outputs_->buffers.emplace_back(cpu_clock_rate, sample_rate_ * sample_rate_adjustment_, max_num_buffered_samples);
+          channel_outputs_->buffers.back().match_timing(output_);
+        }
+
+        if(synthesis_enabled_)
+        {
+          update_channel_outputs(channel_levels());
+        }
+      }
+      else
+      {
+        channel_outputs_.reset();
+      }
+    }
+
+    // reads at most samples.size() samples of a channel's stream and returns the number read
+    // returns 0 while channel outputs are disabled
+    inline std::size_t read_channel_samples(channel c, std::span<float> samples)
+    {
+      if(not channel_outputs_) return 0;
+
+      end_output_frame();
+      return channel_outputs_->buffers[c].read_samples(samples);
+    }
+
+  private:
+    // the channels are configured by writing their registers through write_register
     inline void set_frame_counter_mode_and_interrupts(bool five_step_mode, bool inhibit_interrupts)
     {
       frame_counter_.set(five_step_mode, inhibit_interrupts);
@@ -1015,29 +1622,169 @@ class apu
       noise_.set_length_counter(index);
     }
 
-    inline float sample() const
+    // the mixer is evaluated only when one of the channels changes its level
+    // the change in output is added to the band-limited buffer as a step at the current cycle
+    inline void maybe_add_output_step()
     {
-      float pulse = pulse_0_.value() + pulse_1_.value();
+      std::uint16_t levels = channel_levels();
 
-      float pulse_denom = 8128.f / pulse + 100.f;
-      float pulse_out = 95.88f / pulse_denom;
+      if(levels != channel_levels_)
+      {
+        channel_levels_ = levels;
+        update_output_level(mix(levels));
 
-      float triangle = triangle_.value();
-      float noise = noise_.value();
+        if(channel_outputs_)
+        {
+          update_channel_outputs(levels);
+        }
+      }
+    }
 
-      float tnd_denom = 1.f / (triangle/8227 + noise/12241) + 100.f;
-      float tnd_out = 159.79f / tnd_denom;
+    // the levels of the pulse, triangle, and noise channels packed into four bits each
+    inline std::uint16_t channel_levels() const
+    {
+      return (pulse_0_.value() << 12) | (pulse_1_.value() << 8) | (triangle_.value() << 4) | noise_.value();
+    }
 
-      return pulse_out + tnd_out;
+    // adds a step to each channel output whose level has changed
+    inline void update_channel_outputs(std::uint16_t levels)
+    {
+      // each channel is mixed as though the others were silent
+      std::array<float,num_channels> outputs =
+      {
+        mixer::pulse_table[(levels >> 12) & 0xF],
+        mixer::pulse_table[(levels >>  8) & 0xF],
+        mixer::tnd_table[3 * ((levels >> 4) & 0xF)],
+        mixer::tnd_table[2 * (levels & 0xF)],
+        0
+      };
+
+      for(int i = 0; i < num_channels; ++i)
+      {
+        if(outputs[i] != channel_outputs_->levels[i])
+        {
+          channel_outputs_->buffers[i].add_delta(num_output_cycles_, outputs[i] - channel_outputs_->levels[i]);
+          channel_outputs_->levels[i] = outputs[i];
+        }
+      }
     }
 
-  private:
+    // mixes the packed levels of the channels which are heard
+    inline float mix(std::uint16_t levels) const
+    {
+      levels &= audible_levels_;
+
+      // there is no dmc channel yet, so its level is always 0
+      return mixer_.mix(levels >> 12, (levels >> 8) & 0xF, (levels >> 4) & 0xF, levels & 0xF, 0);
+    }
+
+    inline void update_audible_channels()
+    {
+      bool any_soloed = std::find(soloed_channels_.begin(), soloed_channels_.end(), true) != soloed_channels_.end();
+
+      audible_levels_ = 0;
+      for(int c: {pulse_0, pulse_1, triangle, noise})
+      {
+        bool heard = any_soloed ? soloed_channels_[c] : not muted_channels_[c];
+
+        if(heard)
+        {
+          audible_levels_ |= 0xF << (4 * (noise - c));
+        }
+      }
+
+      // the output changes even though no channel has
+      if(synthesis_enabled_)
+      {
+        update_output_level(sample());
+      }
+    }
+
+    inline void update_output_level(float level)
+    {
+      output_.add_delta(num_output_cycles_, level - output_level_);
+      output_level_ = level;
+    }
+
+    inline void advance_output_cycle()
+    {
+      ++num_output_cycles_;
+
+      // keep frames of the output short enough for the buffer
+      if(num_output_cycles_ == max_num_cycles_per_output_frame)
+      {
+        end_output_frame();
+      }
+    }
+
+    inline void end_output_frame()
+    {
+      output_.end_frame(num_output_cycles_);
+
+      if(channel_outputs_)
+      {
+        for(band_limited_buffer& buffer: channel_outputs_->buffers)
+        {
+          buffer.end_frame(num_output_cycles_);
+        }
+      }
+
+      num_output_cycles_ = 0;
+    }
+
+    inline void update_output_rate()
+    {
+      // steps already added to the current frame were timed at the old rate
+      end_output_frame();
+      output_.set_rates(cpu_clock_rate, sample_rate_ * sample_rate_adjustment_);
+
+      if(channel_outputs_)
+      {
+        for(band_limited_buffer& buffer: channel_outputs_->buffers)
+        {
+          buffer.set_rates(cpu_clock_rate, sample_rate_ * sample_rate_adjustment_);
+        }
+      }
+    }
+
+    constexpr static double max_sample_rate = 192000;
+    constexpr static std::size_t max_num_buffered_samples = 1 << 18;
+    constexpr static std::size_t max_num_cycles_per_output_frame = 1 << 15;
+    static_assert(max_num_cycles_per_output_frame * 1.1 * max_sample_rate / cpu_clock_rate < band_limited_buffer::max_samples_per_frame);
+
     bool is_odd_cpu_clock_;
     pulse_channel pulse_0_;
     pulse_channel pulse_1_;
     triangle_channel triangle_;
     noise_channel noise_;
     frame_counter frame_counter_;
+    mixer mixer_;
+
+    band_limited_buffer output_;
+    double sample_rate_;
+    double sample_rate_adjustment_;
+    std::size_t num_output_cycles_;
+    std::uint16_t channel_levels_;
+    float output_level_;
+
+    // set when something other than clocking the channels, such as a register write, may have changed their levels
+    // it starts out set so that the channels' initial levels are output
+    bool levels_need_checking_;
+    bool synthesis_enabled_;
+
+    std::array<bool,num_channels> muted_channels_;
+    std::array<bool,num_channels> soloed_channels_;
+
+    // the levels of the channels which are heard are masked by ones
+    std::uint16_t audible_levels_;
+
+    struct channel_outputs
+    {
+      std::vector<band_limited_buffer> buffers;
+      std::array<float,num_channels> levels{};
+    };
+
+    std::unique_ptr<channel_outputs> channel_outputs_;
 };
 
 
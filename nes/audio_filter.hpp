@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <numbers>
+#include <span>
+
+
+namespace nes
+{
+
+
+// biquad is one second-order section of an iir filter in transposed direct form II
+// see https://www.w3.org/TR/audio-eq-cookbook/
+class biquad
+{
+  public:
+    // the first-order filters below are made with the bilinear transform and leave the second-order coefficients 0
+    inline static biquad first_order_high_pass(double cutoff, double sample_rate)
+    {
+      double k = std::tan(std::numbers::pi * cutoff / sample_rate);
+      double b0 = 1 / (1 + k);
+      return biquad{b0, -b0, 0, (k - 1) / (k + 1), 0};
+    }
+
+    inline static biquad first_order_low_pass(double cutoff, double sample_rate)
+    {
+      double k = std::tan(std::numbers::pi * cutoff / sample_rate);
+      double b0 = k / (1 + k);
+      return biquad{b0, b0, 0, (k - 1) / (k + 1), 0};
+    }
+
+    inline biquad(double b0, double b1, double b2, double a1, double a2)
+      : b0_{b0}, b1_{b1}, b2_{b2}, a1_{a1}, a2_{a2},
+        z1_{0}, z2_{0}
+    {}
+
+    // changes the coefficients, keeping the filter's state
+    inline void set_coefficients(const biquad& other)
+    {
+      b0_ = other.b0_;
+      b1_ = other.b1_;
+      b2_ = other.b2_;
+      a1_ = other.a1_;
+      a2_ = other.a2_;
+    }
+
+    // filters samples in place
+    inline void process(std::span<float> samples)
+    {
+      // keep the state in locals so that it stays in registers for the whole block
+      double z1 = z1_;
+      double z2 = z2_;
+
+      for(float& sample: samples)
+      {
+        double x = sample;
+        double y = b0_ * x + z1;
+        z1 = b1_ * x - a1_ * y + z2;
+        z2 = b2_ * x - a2_ * y;
+        sample = y;
+      }
+
+      z1_ = z1;
+      z2_ = z2;
+    }
+
+  private:
+    double b0_, b1_, b2_, a1_, a2_;
+    double z1_, z2_;
+};
+
+
+// analog_filter approximates the filters which follow the apu's mixer in an nes
+// they remove the output's dc offset and soften its highest frequencies
+// see https://www.nesdev.org/wiki/APU_Mixer#Emulation
+class analog_filter
+{
+  public:
+    inline analog_filter(double sample_rate)
+      : stages_{make_stages(sample_rate)}
+    {}
+
+    // keeps the filter's state, so this may be called while audio plays
+    inline void set_sample_rate(double sample_rate)
+    {
+      std::array<biquad,3> stages = make_stages(sample_rate);
+
+      for(std::size_t i = 0; i < stages_.size(); ++i)
+      {
+        stages_[i].set_coefficients(stages[i]);
+      }
+    }
+
+    // filters a block of samples in place
+    inline void process(std::span<float> samples)
+    {
+      // each stage runs over the whole block before the next begins
+      // the recurrence within a stage is inherently serial, but this keeps each loop small and its state in registers
+      for(biquad& stage: stages_)
+      {
+        stage.process(samples);
+      }
+    }
+
+  private:
+    inline static std::array<biquad,3> make_stages(double sample_rate)
+    {
+      // "a first-order high-pass filter at 90 Hz, a first-order high-pass filter at 440 Hz, a first-order low-pass filter at 14 kHz"
+      // keep the low-pass below the nyquist frequency at low sample rates
+      double low_pass_cutoff = std::min(14000., 0.45 * sample_rate);
+
+      return {
+        biquad::first_order_high_pass(90, sample_rate),
+        biquad::first_order_high_pass(440, sample_rate),
+        biquad::first_order_low_pass(low_pass_cutoff, sample_rate)
+      };
+    }
+
+    std::array<biquad,3> stages_;
+};
+
+
+} // end nes
+
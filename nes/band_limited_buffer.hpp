@@ -0,0 +1,183 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <numbers>
+#include <span>
+#include <vector>
+
+
+namespace nes
+{
+
+
+// band_limited_buffer resamples a signal made of steps, which occur at a high clock rate, to a lower output sample rate
+// rather than sampling the signal, each step is added as a band-limited step: its delta is spread over the
+// neighboring output samples by a windowed sinc kernel. reading samples integrates the deltas
+// see https://www.cs.cmu.edu/~eli/papers/icmc01-hardsync.pdf
+class band_limited_buffer
+{
+  public:
+    constexpr static int num_taps = 16;
+    constexpr static int num_phase_bits = 6;
+    constexpr static int num_phases = 1 << num_phase_bits;
+
+    // the buffer holds at most max_num_samples unread samples
+    // when it fills, the oldest are discarded
+    inline band_limited_buffer(double clock_rate, double sample_rate, std::size_t max_num_samples)
+      : deltas_(max_num_samples + num_taps),
+        time_per_clock_{},
+        time_{0},
+        level_{0}
+    {
+      set_rates(clock_rate, sample_rate);
+    }
+
+    // this should be called between frames, as steps already added to the current frame were timed at the previous rates
+    inline void set_rates(double clock_rate, double sample_rate)
+    {
+      // time is kept in fixed point output samples with time_fraction_bits of fraction
+      time_per_clock_ = std::llround(sample_rate / clock_rate * (std::uint64_t{1} << time_fraction_bits));
+    }
+
+    // adds a step of the given size to the signal at the given clock, counted from the beginning of the current frame
+    inline void add_delta(std::size_t clock, float delta)
+    {
+      std::uint64_t time = time_ + clock * time_per_clock_;
+      std::size_t sample = time >> time_fraction_bits;
+      std::size_t phase = (time >> (time_fraction_bits - num_phase_bits)) & (num_phases - 1);
+
+      assert(sample + num_taps <= deltas_.size());
+
+      const std::array<float,num_taps>& kernel = kernels()[phase];
+      float* d = deltas_.data() + sample;
+      for(int i = 0; i < num_taps; ++i)
+      {
+        d[i] += delta * kernel[i];
+      }
+    }
+
+    // ends the current frame after the given number of clocks, which makes the frame's samples available to read
+    // the next frame begins at that clock
+    inline void end_frame(std::size_t num_clocks)
+    {
+      time_ += num_clocks * time_per_clock_;
+
+      std::size_t capacity = deltas_.size() - num_taps;
+      if(num_samples_available() > capacity - max_samples_per_frame)
+      {
+        discard(num_samples_available() - (capacity - max_samples_per_frame));
+      }
+    }
+
+    // the most number of samples which may be produced by a single frame
+    // frames must not be so long that they exceed this
+    constexpr static std::size_t max_samples_per_frame = 4096;
+
+    // gives this buffer the same number of unread samples and the same position within the current output sample as other
+    // the samples which this buffer already holds are unchanged, so a new buffer reads silence until its first step
+    inline void match_timing(const band_limited_buffer& other)
+    {
+      assert(deltas_.size() == other.deltas_.size());
+      time_ = other.time_;
+    }
+
+    inline std::size_t num_samples_available() const
+    {
+      return time_ >> time_fraction_bits;
+    }
+
+    // reads at most samples.size() samples and returns the number read
+    inline std::size_t read_samples(std::span<float> samples)
+    {
+      std::size_t n = std::min(samples.size(), num_samples_available());
+
+      for(std::size_t i = 0; i < n; ++i)
+      {
+        level_ += deltas_[i];
+        samples[i] = level_;
+      }
+
+      remove(n);
+
+      return n;
+    }
+
+  private:
+    constexpr static int time_fraction_bits = 32;
+
+    // drops the oldest n samples, keeping the signal's level
+    inline void discard(std::size_t n)
+    {
+      for(std::size_t i = 0; i < n; ++i)
+      {
+        level_ += deltas_[i];
+      }
+
+      remove(n);
+    }
+
+    inline void remove(std::size_t n)
+    {
+      // move the deltas which remain, including those which extend past the available samples, to the front
+      std::size_t num_remaining = num_samples_available() - n + num_taps;
+      std::copy(deltas_.begin() + n, deltas_.begin() + n + num_remaining, deltas_.begin());
+      std::fill(deltas_.begin() + num_remaining, deltas_.begin() + n + num_remaining, 0.f);
+
+      time_ -= std::uint64_t{n} << time_fraction_bits;
+    }
+
+    using kernel_table = std::array<std::array<float,num_taps>,num_phases>;
+
+    // each phase of the kernel is a band-limited impulse centered between its two middle taps, offset by the phase
+    inline static const kernel_table& kernels()
+    {
+      static const kernel_table result = []
+      {
+        kernel_table result;
+
+        // cut off a little below the nyquist frequency so that the window's transition band doesn't alias
+        constexpr double cutoff = 0.9;
+
+        for(int phase = 0; phase < num_phases; ++phase)
+        {
+          double offset = double(phase) / num_phases;
+          double sum = 0;
+
+          for(int i = 0; i < num_taps; ++i)
+          {
+            // the distance in samples from the step, and its position within the window
+            double x = i - (num_taps/2 - 1) - offset;
+            double w = (x + num_taps/2) / num_taps;
+
+            double sinc = x == 0 ? 1 : std::sin(std::numbers::pi * cutoff * x) / (std::numbers::pi * cutoff * x);
+            double blackman = 0.42 - 0.5 * std::cos(2 * std::numbers::pi * w) + 0.08 * std::cos(4 * std::numbers::pi * w);
+
+            result[phase][i] = sinc * blackman;
+            sum += result[phase][i];
+          }
+
+          // normalize so that each step reaches exactly its full size
+          for(float& tap: result[phase])
+          {
+            tap /= sum;
+          }
+        }
+
+        return result;
+      }();
+
+      return result;
+    }
+
+    std::vector<float> deltas_;
+    std::uint64_t time_per_clock_;
+    std::uint64_t time_;
+    double level_;
+};
+
+
+} // end nes
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "mapped_file.hpp"
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <utility>
+
+
+namespace nes
+{
+
+
+// battery_backed_ram is cartridge ram whose contents persist in a save file while the power is off
+// the save file is mapped into memory and shared with the os, which writes back only the pages which were modified,
+// in the background. so the emulation thread writes to this ram as to any other memory, and never waits on file i/o
+class battery_backed_ram
+{
+  public:
+    // a save file which doesn't exist yet is created, filled with zeros
+    // returns nullptr if the save file can't be used, e.g. because another instance of the same game is using it,
+    // or because the directory it belongs in isn't writable
+    inline static std::unique_ptr<battery_backed_ram> try_open(const std::filesystem::path& filename, std::size_t size)
+    {
+      std::optional<mapped_file> file;
+
+      try
+      {
+        file = mapped_file::try_open_writable(filename, size);
+      }
+      catch(std::runtime_error&)
+      {
+      }
+
+      if(not file)
+      {
+        return nullptr;
+      }
+
+      return std::unique_ptr<battery_backed_ram>(new battery_backed_ram{std::move(*file)});
+    }
+
+    inline std::span<std::uint8_t> bytes() const
+    {
+      return file_.writable_bytes();
+    }
+
+  private:
+    inline battery_backed_ram(mapped_file&& file)
+      : file_{std::move(file)}
+    {}
+
+    mapped_file file_;
+};
+
+
+} // end nes
+
@@ -0,0 +1,464 @@
+#pragma once
+
+#include "audio_filter.hpp"
+#include "ppu.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace nes
+{
+
+
+// capture records emulated frames and audio samples to files
+// the emulation thread hands frames and blocks of samples to a background thread which does all of the file i/o
+// all buffers are allocated up front. when the writer falls behind, data is dropped and counted rather than
+// making the emulation thread wait
+class capture
+{
+  public:
+    constexpr static int frame_width  = ppu::framebuffer_width;
+    constexpr static int frame_height = ppu::framebuffer_height;
+
+    enum video_format
+    {
+      raw_rgb,      // a headerless stream of 24-bit rgb frames
+      y4m,          // YUV4MPEG2 with full resolution chroma
+      ppm_sequence  // one numbered ppm file per frame
+    };
+
+    // returns the video format implied by a filename's extension
+    inline static video_format video_format_for(const std::filesystem::path& filename)
+    {
+      if(filename.extension() == ".y4m") return y4m;
+      if(filename.extension() == ".ppm") return ppm_sequence;
+      return raw_rgb;
+    }
+
+    struct options
+    {
+      // an empty filename disables that stream
+      std::filesystem::path video_filename;
+      std::filesystem::path audio_filename;
+
+      video_format video = raw_rgb;
+      int audio_sample_rate = 88200;
+
+      // when set, audio passes through an analog_filter before it is written, which removes its dc offset
+      // by default, audio is written exactly as the apu produced it
+      bool filter_audio = false;
+
+      std::size_t num_frame_buffers = 16;
+      std::size_t num_audio_buffers = 16;
+      std::size_t audio_buffer_size = 4096;
+    };
+
+    inline capture(const options& opts)
+      : options_{opts},
+        frames_(opts.video_filename.empty() ? 0 : opts.num_frame_buffers),
+        audio_buffers_(opts.audio_filename.empty() ? 0 : opts.num_audio_buffers),
+        current_audio_buffer_{},
+        audio_filter_{double(opts.audio_sample_rate)},
+        num_submissions_{0},
+        closing_{false},
+        num_frames_written_{0},
+        num_frames_dropped_{0},
+        num_audio_samples_written_{0},
+        num_audio_samples_dropped_{0},
+        error_{}
+    {
+      for(auto& b: audio_buffers_.buffers)
+      {
+        b.samples.resize(options_.audio_buffer_size);
+      }
+
+      // open files here so that errors are reported to the caller
+      if(options_.video != ppm_sequence and not options_.video_filename.empty())
+      {
+        video_file_ = open(options_.video_filename);
+
+        if(options_.video == y4m)
+        {
+          // the nes's pixels are 8:7, and it produces 60.0988 frames per second
+          video_file_ << fmt::format("YUV4MPEG2 W{} H{} F39375000:655171 Ip A8:7 C444\n", frame_width, frame_height);
+        }
+      }
+
+      if(not options_.audio_filename.empty())
+      {
+        audio_file_ = open(options_.audio_filename);
+
+        // the sizes in the header get filled in when the file is closed
+        write_wav_header(0);
+      }
+
+      writer_ = std::thread([this]{ write_until_closed(); });
+    }
+
+    inline ~capture()
+    {
+      close();
+    }
+
+    capture(const capture&) = delete;
+    capture& operator=(const capture&) = delete;
+
+    // the following functions must be called by the thread which produces frames and samples
+
+    inline void submit_frame(std::span<const ppu::rgb, frame_width*frame_height> framebuffer)
+    {
+      if(frames_.buffers.empty()) return;
+
+      if(auto* f = frames_.begin_produce())
+      {
+        std::copy(framebuffer.begin(), framebuffer.end(), f->begin());
+        frames_.end_produce();
+        wake_writer();
+      }
+      else
+      {
+        ++num_frames_dropped_;
+      }
+    }
+
+    inline void submit_audio(std::span<const float> samples)
+    {
+      if(audio_buffers_.buffers.empty()) return;
+
+      while(not samples.empty())
+      {
+        if(not current_audio_buffer_)
+        {
+          current_audio_buffer_ = audio_buffers_.begin_produce();
+
+          if(not current_audio_buffer_)
+          {
+            num_audio_samples_dropped_ += samples.size();
+            return;
+          }
+
+          current_audio_buffer_->size = 0;
+        }
+
+        // fill as much of the current buffer as possible
+        std::size_t n = std::min(samples.size(), current_audio_buffer_->samples.size() - current_audio_buffer_->size);
+        std::copy_n(samples.begin(), n, current_audio_buffer_->samples.begin() + current_audio_buffer_->size);
+        current_audio_buffer_->size += n;
+        samples = samples.subspan(n);
+
+        if(current_audio_buffer_->size == current_audio_buffer_->samples.size())
+        {
+          submit_audio_buffer();
+        }
+      }
+    }
+
+    // writes everything submitted so far, then stops the writer and closes the files
+    // errors which happen along the way don't interrupt emulation. afterwards, error() describes the first of them
+    inline void close()
+    {
+      if(not writer_.joinable()) return;
+
+      if(current_audio_buffer_)
+      {
+        submit_audio_buffer();
+      }
+
+      closing_ = true;
+      wake_writer();
+      writer_.join();
+
+      if(audio_file_.is_open())
+      {
+        audio_file_.seekp(0);
+        write_wav_header(num_audio_samples_written_);
+        audio_file_.close();
+
+        if(not audio_file_ and error_.empty())
+        {
+          error_ = fmt::format("capture: Couldn't write {}", options_.audio_filename.string());
+        }
+      }
+
+      if(video_file_.is_open())
+      {
+        video_file_.close();
+
+        if(not video_file_ and error_.empty())
+        {
+          error_ = fmt::format("capture: Couldn't write {}", options_.video_filename.string());
+        }
+      }
+    }
+
+    // returns a description of the first error the capture encountered, or an empty string if there was none
+    // this is only valid after close()
+    inline const std::string& error() const
+    {
+      return error_;
+    }
+
+    inline std::size_t num_frames_written() const
+    {
+      return num_frames_written_;
+    }
+
+    inline std::size_t num_frames_dropped() const
+    {
+      return num_frames_dropped_;
+    }
+
+    inline std::size_t num_audio_samples_written() const
+    {
+      return num_audio_samples_written_;
+    }
+
+    inline std::size_t num_audio_samples_dropped() const
+    {
+      return num_audio_samples_dropped_;
+    }
+
+  private:
+    using frame = std::array<ppu::rgb, frame_width*frame_height>;
+
+    struct audio_buffer
+    {
+      std::vector<float> samples;
+      std::size_t size;
+    };
+
+    // a fixed number of buffers passed from a single producer to a single consumer in order
+    template<class T>
+    struct buffer_ring
+    {
+      std::vector<T> buffers;
+      std::atomic<std::size_t> num_produced;
+      std::atomic<std::size_t> num_consumed;
+
+      inline buffer_ring(std::size_t n)
+        : buffers(n),
+          num_produced{0},
+          num_consumed{0}
+      {}
+
+      // returns the next buffer to fill, or nullptr if they are all waiting to be consumed
+      inline T* begin_produce()
+      {
+        std::size_t i = num_produced.load(std::memory_order_relaxed);
+        if(i - num_consumed.load(std::memory_order_acquire) == buffers.size()) return nullptr;
+        return &buffers[i % buffers.size()];
+      }
+
+      inline void end_produce()
+      {
+        num_produced.fetch_add(1, std::memory_order_release);
+      }
+
+      // returns the next buffer to consume, or nullptr if none are ready
+      inline T* begin_consume()
+      {
+        std::size_t i = num_consumed.load(std::memory_order_relaxed);
+        if(i == num_produced.load(std::memory_order_acquire)) return nullptr;
+        return &buffers[i % buffers.size()];
+      }
+
+      inline void end_consume()
+      {
+        num_consumed.fetch_add(1, std::memory_order_release);
+      }
+    };
+
+    inline static std::ofstream open(const std::filesystem::path& filename)
+    {
+      std::ofstream result{filename, std::ios::binary};
+      if(not result)
+      {
+        throw std::runtime_error(fmt::format("capture: Couldn't open {}", filename.string()));
+      }
+
+      return result;
+    }
+
+    inline void submit_audio_buffer()
+    {
+      audio_buffers_.end_produce();
+      current_audio_buffer_ = nullptr;
+      wake_writer();
+    }
+
+    inline void wake_writer()
+    {
+      ++num_submissions_;
+      num_submissions_.notify_one();
+    }
+
+    inline void write_until_closed()
+    {
+      while(true)
+      {
+        // note the number of submissions before looking for work so that none are missed while waiting
+        std::uint64_t num_submissions = num_submissions_;
+        bool was_closing = closing_;
+
+        bool wrote_something = false;
+
+        while(frame* f = frames_.begin_consume())
+        {
+          try
+          {
+            write_frame(*f);
+            ++num_frames_written_;
+          }
+          catch(std::exception& e)
+          {
+            // a frame which can't be written is dropped, as one which arrives while the writer is behind is
+            ++num_frames_dropped_;
+            if(error_.empty()) error_ = e.what();
+          }
+
+          frames_.end_consume();
+          wrote_something = true;
+        }
+
+        while(audio_buffer* b = audio_buffers_.begin_consume())
+        {
+          if(options_.filter_audio)
+          {
+            audio_filter_.process(std::span(b->samples.data(), b->size));
+          }
+
+          audio_file_.write(reinterpret_cast<const char*>(b->samples.data()), sizeof(float) * b->size);
+          num_audio_samples_written_ += b->size;
+          audio_buffers_.end_consume();
+          wrote_something = true;
+        }
+
+        // everything submitted before closing began has been written
+        if(was_closing) break;
+
+        if(not wrote_something)
+        {
+          num_submissions_.wait(num_submissions);
+        }
+      }
+    }
+
+    inline void write_frame(const frame& f)
+    {
+      static_assert(sizeof(ppu::rgb) == 3, "ppu::rgb must be tightly packed");
+      const char* pixels = reinterpret_cast<const char*>(f.data());
+
+      switch(options_.video)
+      {
+        case raw_rgb:
+        {
+          video_file_.write(pixels, sizeof(f));
+          break;
+        }
+
+        case y4m:
+        {
+          // see https://wiki.multimedia.cx/index.php/YUV4MPEG2
+          // convert to studio range BT.601, one plane at a time
+          video_file_ << "FRAME\n";
+
+          auto write_plane = [&](auto component)
+          {
+            std::transform(f.begin(), f.end(), y4m_plane_.begin(), component);
+            video_file_.write(reinterpret_cast<const char*>(y4m_plane_.data()), y4m_plane_.size());
+          };
+
+          write_plane([](ppu::rgb c) { return std::uint8_t((( 66*c.r + 129*c.g +  25*c.b + 128) >> 8) +  16); });
+          write_plane([](ppu::rgb c) { return std::uint8_t(((-38*c.r -  74*c.g + 112*c.b + 128) >> 8) + 128); });
+          write_plane([](ppu::rgb c) { return std::uint8_t(((112*c.r -  94*c.g -  18*c.b + 128) >> 8) + 128); });
+          break;
+        }
+
+        case ppm_sequence:
+        {
+          // frames are numbered after the stem of the video filename, e.g. out.ppm -> out_000000.ppm
+          // the number is the frame's position among those submitted, so frames which couldn't be written leave gaps
+          std::filesystem::path filename = options_.video_filename;
+          filename.replace_filename(fmt::format("{}_{:06}.ppm", options_.video_filename.stem().string(), frames_.num_consumed.load()));
+
+          std::ofstream file = open(filename);
+          file << fmt::format("P6\n{} {}\n255\n", frame_width, frame_height);
+          file.write(pixels, sizeof(f));
+
+          if(not file.flush())
+          {
+            throw std::runtime_error(fmt::format("capture: Couldn't write {}", filename.string()));
+          }
+
+          break;
+        }
+      }
+    }
+
+    // see http://soundfile.sapp.org/doc/WaveFormat/
+    inline void write_wav_header(std::uint32_t num_samples)
+    {
+      auto put = [&](auto value)
+      {
+        audio_file_.write(reinterpret_cast<const char*>(&value), sizeof(value));
+      };
+
+      // samples are written losslessly as mono 32-bit floats
+      std::uint32_t data_size = num_samples * sizeof(float);
+
+      audio_file_.write("RIFF", 4);
+      put(std::uint32_t(36 + data_size));
+      audio_file_.write("WAVE", 4);
+
+      audio_file_.write("fmt ", 4);
+      put(std::uint32_t(16));
+      put(std::uint16_t(3)); // IEEE float
+      put(std::uint16_t(1)); // channels
+      put(std::uint32_t(options_.audio_sample_rate));
+      put(std::uint32_t(options_.audio_sample_rate * sizeof(float)));
+      put(std::uint16_t(sizeof(float)));
+      put(std::uint16_t(8 * sizeof(float)));
+
+      audio_file_.write("data", 4);
+      put(data_size);
+    }
+
+    options options_;
+
+    std::ofstream video_file_;
+    std::ofstream audio_file_;
+    std::array<std::uint8_t, frame_width*frame_height> y4m_plane_;
+
+    buffer_ring<frame> frames_;
+    buffer_ring<audio_buffer> audio_buffers_;
+    audio_buffer* current_audio_buffer_;
+
+    // the filter is only used by the writer thread
+    analog_filter audio_filter_;
+
+    std::atomic<std::uint64_t> num_submissions_;
+    std::atomic<bool> closing_;
+
+    std::atomic<std::size_t> num_frames_written_;
+    std::atomic<std::size_t> num_frames_dropped_;
+    std::atomic<std::size_t> num_audio_samples_written_;
+    std::atomic<std::size_t> num_audio_samples_dropped_;
+
+    // only the writer thread sets this until it is joined
+    std::string error_;
+
+    std::thread writer_;
+};
+
+
+} // end nes
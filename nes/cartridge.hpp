@@ -1,10 +1,15 @@
 #pragma once
 
+#include "battery_backed_ram.hpp"
+#include "mapper.hpp"
+#include "rom_image.hpp"
+#include <algorithm>
+#include <array>
 #include <cstdint>
-#include <fmt/format.h>
-#include <fstream>
-#include <optional>
-#include <stdexcept>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <span>
 #include <vector>
 
 
@@ -12,199 +17,192 @@ namespace nes
 {
 
 
-class nrom
+class cartridge
 {
-  private:
-    int num_prg_banks_;
-
   public:
-    inline nrom(int num_prg_banks)
-      : num_prg_banks_{num_prg_banks}
-    {}
-
-    // this returns optional<uint16_t> because some games try to read to
-    // addresses which have no physical location. this condition is called an "open bus"
-    inline std::optional<std::uint16_t> map(std::uint16_t address) const
+    using nametable_mirroring_kind = mapper::nametable_mirroring_kind;
+    using enum mapper::nametable_mirroring_kind;
+
+    using ines_file_header = nes::ines_file_header;
+
+    // the mappers here map at most 8KB of prg ram to 0x6000 - 0x7FFF
+    constexpr static std::size_t prg_ram_window_size = 8192;
+
+    // the pattern tables hold 512 tiles of 16B each
+    // a pattern_tile_mask has one bit per tile, numbered by pattern table address / 16
+    constexpr static int num_pattern_tiles = 512;
+    using pattern_tile_mask = std::array<std::uint64_t, num_pattern_tiles / 64>;
+
+    // the rom image is shared, and only the cartridge's writable memory is allocated here
+    // battery-backed prg ram is kept in the save file, if one is given which can be opened and no other cartridge is using it.
+    // otherwise, the prg ram is forgotten when the cartridge is destroyed
+    inline cartridge(std::shared_ptr<const rom_image> rom, const std::filesystem::path& save_filename = {})
+      : rom_{rom},
+        // cartridges without chr rom have chr ram instead
+        chr_ram_(rom_->chr_rom().empty() ? std::max<std::size_t>(8192, rom_->header().chr_ram_size()) : 0),
+        battery_ram_{},
+        prg_ram_{},
+        four_screen_vram_(rom_->header().mirroring() == four_screen ? 2048 : 0),
+        dirty_tiles_{}
     {
-      std::optional<std::uint16_t> result;
+      // XXX prg ram smaller than 8KB ought to be mirrored within the window rather than grown to fill it,
+      //     and larger prg ram needs banking which the mappers here don't do
+      const ines_file_header& header = rom_->header();
+      bool has_prg_ram = header.prg_ram_size() + header.prg_nvram_size() != 0;
 
-      if(address >= 0x8000)
+      if(header.prg_nvram_size() != 0 and not save_filename.empty())
       {
-        // map incoming addresses beginning at 0x8000 to the first bye of PRG memory
-        address -= 0x8000;
-
-        if(num_prg_banks_ == 1)
-        {
-          // this mask does mirroring for when we have a single bank
-          address &= 0x3FFF;
-        }
+        battery_ram_ = battery_backed_ram::try_open(save_filename, prg_ram_window_size);
+      }
 
-        result = address;
+      if(not battery_ram_ and has_prg_ram)
+      {
+        prg_ram_.resize(prg_ram_window_size);
       }
 
-      return result;
-    }
+      std::span<const std::uint8_t> chr_memory = chr_ram_.empty() ? rom_->chr_rom() : std::span<const std::uint8_t>{chr_ram_};
+      std::span<std::uint8_t> prg_ram = battery_ram_ ? battery_ram_->bytes() : std::span<std::uint8_t>{prg_ram_};
 
-    inline std::uint16_t map_graphics(std::uint16_t address) const
-    {
-      if(address >= 0x2000)
+      mapper_ = make_mapper(header.mapper_id(), rom_->prg_rom(), chr_memory, prg_ram, header.mirroring());
+
+      // nothing has observed the pattern tables yet
+      dirty_tiles_.fill(~std::uint64_t{0});
+
+      // switching chr banks changes every tile which the switch remaps
+      mapper_->on_graphics_changing([this]
       {
-        throw std::runtime_error(fmt::format("nrom::map_graphics: Bad address: {:04X}", address));
-      }
+        dirty_tiles_.fill(~std::uint64_t{0});
 
-      return address;
+        if(graphics_changing_)
+        {
+          graphics_changing_();
+        }
+      });
     }
-};
 
+    inline cartridge(std::istream&& is)
+      : cartridge{std::make_shared<const rom_image>(is)}
+    {}
 
-class cartridge
-{
-  public:
-    enum nametable_mirroring_kind
-    {
-      // XXX there are others
-      horizontal, vertical
-    };
-
-    // see https://www.nesdev.org/wiki/INES#iNES_file_format
-    struct ines_file_header
-    {
-      char name[4];
-      std::uint8_t num_prg_rom_chunks;
-      std::uint8_t num_chr_rom_chunks;
-      std::uint8_t flags_6;
-      std::uint8_t flags_7;
-      std::uint8_t flags_8;
-      std::uint8_t flags_9;
-      std::uint8_t flags_10;
-      char unused[5];
-
-      inline ines_file_header(std::istream &is)
-      {
-        is.read(reinterpret_cast<char*>(this), sizeof(ines_file_header));
-      }
+    inline cartridge(const std::string& filename)
+      : cartridge{rom_image::open(filename)}
+    {}
 
-      inline int mapper_id() const
-      {
-        return (flags_7 & 0xF0) | (flags_6 >> 4);
-      }
+    // the mapper calls back into the cartridge, so the cartridge must stay where it is
+    cartridge(const cartridge&) = delete;
+    cartridge& operator=(const cartridge&) = delete;
 
-      inline bool trainer_present() const
-      {
-        return flags_6 & 0x04;
-      }
+    inline nametable_mirroring_kind nametable_mirroring() const
+    {
+      return mapper_->nametable_mirroring();
+    }
 
-      inline nametable_mirroring_kind mirroring() const
-      {
-        return (flags_6 & 0x01) ? vertical : horizontal;
-      }
-    };
+    // f is called whenever nametable mirroring changes
+    inline void on_nametable_mirroring_changed(std::function<void()> f)
+    {
+      mapper_->on_nametable_mirroring_changed(f);
+    }
 
-    // XXX ideally, a cartridge is constructed from two arrays (prg & chr data) and a mapper
-    //     so we should create a function whose job is to take a filename and return the tuple (mapper, prg_data, chr_data)
+    // f is called before the mapper changes chr banks or nametable mirroring, which changes what the ppu reads
+    inline void on_graphics_changing(std::function<void()> f)
+    {
+      graphics_changing_ = f;
+    }
 
-    inline cartridge(int num_prg_banks, int num_chr_banks, nametable_mirroring_kind mirroring, bool trainer_present_in_stream, std::istream& is)
-      : num_prg_banks_{num_prg_banks},
-        num_chr_banks_{num_chr_banks},
-        nametable_mirroring_{mirroring},
-        prg_memory_(num_prg_banks_ * 16384),
-        chr_memory_(num_chr_banks_ * 8192),
-        mapper_{num_prg_banks_}
+    // four-screen cartridges provide an extra 2KB of vram for the third and fourth nametables
+    inline std::span<std::uint8_t> four_screen_vram()
     {
-      // if a 512B trainer is present, ignore it
-      if(trainer_present_in_stream)
-      {
-        is.seekg(512, std::ios_base::cur);
-      }
+      return four_screen_vram_;
+    }
 
-      // read in PRG data
-      is.read(reinterpret_cast<char*>(prg_memory_.data()), prg_memory_.size());
+    inline std::uint8_t read(std::uint16_t address) const
+    {
+      return mapper_->read(address);
+    }
 
-      // read in CHR data
-      is.read(reinterpret_cast<char*>(chr_memory_.data()), chr_memory_.size());
+    inline void write(std::uint16_t address, std::uint8_t value)
+    {
+      mapper_->write(address, value);
     }
 
-    inline cartridge(ines_file_header header, std::istream& is)
-      : cartridge{header.num_prg_rom_chunks, header.num_chr_rom_chunks, header.mirroring(), header.trainer_present(), is}
+    inline std::uint8_t graphics_read(std::uint16_t address) const
     {
-      if(header.mapper_id() != 0)
-      {
-        throw std::runtime_error(fmt::format("cartridge: ROM requires unsupported mapper {}", header.mapper_id()));
-      }
+      return mapper_->graphics_read(address);
+    }
 
-      if(header.flags_6 & 0b00001000)
+    // writes to chr ram and marks the tiles which the write changes as dirty
+    // chr rom ignores writes
+    inline void graphics_write(std::uint16_t address, std::uint8_t value)
+    {
+      if(chr_ram_.empty()) return;
+
+      std::size_t offset = mapper_->chr_offset(address);
+      if(chr_ram_[offset] == value) return;
+
+      chr_ram_[offset] = value;
+
+      // a mapper may show the same 1KB of chr ram in more than one slot, and each of them changes
+      std::size_t page = offset - (address & (mapper::chr_slot_size - 1));
+      for(std::uint16_t slot_address = 0; slot_address < 0x2000; slot_address += mapper::chr_slot_size)
       {
-        throw std::runtime_error("ROM requires four-screen VRAM");
+        if(mapper_->chr_offset(slot_address) == page)
+        {
+          int tile = (slot_address | (address & (mapper::chr_slot_size - 1))) >> 4;
+          dirty_tiles_[tile / 64] |= std::uint64_t{1} << (tile % 64);
+        }
       }
     }
 
-    inline cartridge(std::istream&& is)
-      : cartridge{ines_file_header{is}, is}
-    {}
-
-    inline cartridge(const std::string& filename)
-      : cartridge{std::ifstream{filename.c_str(), std::ios::binary}}
-    {}
-
-    inline nametable_mirroring_kind nametable_mirroring() const
+    // returns which tiles of the pattern tables have changed since the dirty tiles were last cleared,
+    // either by a write to chr ram or because the mapper switched chr banks
+    inline const pattern_tile_mask& dirty_tiles() const
     {
-      return nametable_mirroring_;
+      return dirty_tiles_;
     }
 
-    inline std::uint8_t read(std::uint16_t address) const
+    inline void clear_dirty_tiles()
     {
-      auto mapped_address = mapper_.map(address);
+      dirty_tiles_.fill(0);
+    }
 
-      // detect an open bus and return 0 in this case
-      // see https://www.nesdev.org/wiki/Open_bus_behavior
-      // XXX what we do here does not model the actual NES behavior
-      // per that webpage, on an actual NES, reading an open bus repeats the
-      // last value that was read on the bus before this read
-      // instead, we'll just return 0
-      // to model the NES behavior, we'd need some extra state in the bus class
-      // to remember the previous value returned from bus::read and return that
-      // in an open bus case
-      return mapped_address ? prg_memory_[*mapped_address] : 0;
+    // returns whether or not the mapper is asserting the cpu's interrupt request line
+    inline bool interrupt_request() const
+    {
+      return mapper_->interrupt_request();
     }
 
-    inline void write(std::uint16_t address, std::uint8_t value)
+    inline bool watches_a12() const
     {
-      // XXX this hack allows us to override the reset vector while debugging
-      if(address == 0xFFFC or address == 0xFFFD)
-      {
-        auto mapped_address = mapper_.map(address);
+      return mapper_->watches_a12();
+    }
 
-        if(not mapped_address)
-        {
-          throw std::runtime_error(fmt::format("cartridge::write: Bad address: {:04X}", address));
-        }
+    inline void a12_rose()
+    {
+      mapper_->a12_rose();
+    }
 
-        prg_memory_[*mapped_address] = value;
-      }
-      else
-      {
-        throw std::runtime_error(fmt::format("cartridge::write: Bad address: {:04X}", address));
-      }
+    // returns whether or not prg ram is kept in a save file
+    inline bool battery_backed() const
+    {
+      return static_cast<bool>(battery_ram_);
     }
 
-    inline std::uint8_t graphics_read(std::uint16_t address) const
+    inline std::shared_ptr<const rom_image> rom() const
     {
-      std::uint16_t mapped_address = mapper_.map_graphics(address);
-      return chr_memory_[mapped_address];
+      return rom_;
     }
 
   private:
-    // XXX these values are possibly only relevant to the mapper
-    int num_prg_banks_;
-    int num_chr_banks_;
-    nametable_mirroring_kind nametable_mirroring_;
-
-    std::vector<std::uint8_t> prg_memory_;
-    std::vector<std::uint8_t> chr_memory_;
-
-    nrom mapper_;
+    std::shared_ptr<const rom_image> rom_;
+    std::vector<std::uint8_t> chr_ram_;
+    std::unique_ptr<battery_backed_ram> battery_ram_;
+    std::vector<std::uint8_t> prg_ram_;
+    std::vector<std::uint8_t> four_screen_vram_;
+
+    std::unique_ptr<mapper> mapper_;
+    std::function<void()> graphics_changing_;
+    pattern_tile_mask dirty_tiles_;
 };
 
 
 } // end nes
-
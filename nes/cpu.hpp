@@ -196,6 +196,7 @@ constexpr std::array<instruction_info,256> initialize_instruction_info_table()
   result[0x55] = {"EOR", EOR,         zero_page_x_indexed, 4};
   result[0x56] = {"LSR", LSR,         zero_page_x_indexed, 6};
   result[0x57] = {"SRE", SRE,         zero_page_x_indexed, 6};
+  result[0x58] = {"CLI", CLI,         implied,             2};
   result[0x59] = {"EOR", EOR,         absolute_y_indexed,  4};
   result[0x5A] = {"NOP", Illegal_NOP, implied,             2};
   result[0x5B] = {"SRE", SRE,         absolute_y_indexed,  7};
@@ -348,7 +349,9 @@ constexpr std::array<instruction_info,256> initialize_instruction_info_table()
 }
 
 
-class cpu
+// the cpu reads and writes memory through a Bus, which provides read(address) and write(address, value)
+template<class Bus>
+class basic_cpu
 {
   public:
     // XXX some of this needn't be public
@@ -362,7 +365,7 @@ class cpu
 
     static constexpr std::array<instruction_info,256> instruction_info_table = initialize_instruction_info_table();
 
-    cpu(bus& bus)
+    basic_cpu(Bus& bus)
       : program_counter_{}, stack_pointer_{}, accumulator_{}, index_register_x_{}, index_register_y_{},
         negative_flag_{}, overflow_flag_{}, decimal_mode_flag_{}, interrupt_request_disable_flag_{}, zero_flag_{}, carry_flag_{},
         bus_{bus}
@@ -410,31 +413,27 @@ class cpu
     // returns the number of cycles consumed
     int nonmaskable_interrupt()
     {
-      // push the program counter to the stack
-      std::uint8_t low_pc_byte = static_cast<std::uint8_t>(program_counter_);
-      std::uint8_t high_pc_byte = program_counter_ >> 8;
-
-      push_stack(high_pc_byte);
-      push_stack(low_pc_byte);
+      enter_interrupt(nonmaskable_interrupt_request_vector_location);
 
-      std::uint8_t value = status_flags_as_byte();
+      // this takes 8 cycles
+      return 8;
+    }
 
-      // see https://www.nesdev.org/wiki/Status_flags#The_B_flag
-      value |= 0b00100000; // set bit 5
-      value &= 0b11101111; // clear bit 4
 
-      push_stack(value);
+    // executes an interrupt request, which the caller should only do while the interrupt request disable flag is clear
+    // returns the number of cycles consumed
+    int interrupt_request()
+    {
+      enter_interrupt(interrupt_request_vector_location);
 
-      // disable interrupts
-      interrupt_request_disable_flag_ = true;
+      // see https://www.nesdev.org/wiki/CPU_interrupts#IRQ_and_NMI_tick-by-tick_execution
+      return 7;
+    }
 
-      // read the new program counter from the nonmaskable_interrupt_request_vector_location
-      low_pc_byte = read(nonmaskable_interrupt_request_vector_location);
-      high_pc_byte = read(nonmaskable_interrupt_request_vector_location + 1);
-      program_counter_ = (high_pc_byte << 8) | low_pc_byte;
 
-      // this takes 8 cycles
-      return 8;
+    inline bool interrupt_request_disable_flag() const
+    {
+      return interrupt_request_disable_flag_;
     }
 
 
@@ -444,6 +443,25 @@ class cpu
     }
 
 
+    // these allow a caller to set up registers before jumping into a subroutine, e.g. to call an nsf's routines
+    inline void set_program_counter(std::uint16_t value)
+    {
+      program_counter_ = value;
+    }
+
+
+    inline void set_accumulator(std::uint8_t value)
+    {
+      accumulator_ = value;
+    }
+
+
+    inline void set_index_register_x(std::uint8_t value)
+    {
+      index_register_x_ = value;
+    }
+
+
     void log(std::ostream& os, int cpu_cycle, int ppu_cycle) const
     {
       instruction i = read_current_instruction();
@@ -533,7 +551,7 @@ class cpu
     bool zero_flag_;
     bool carry_flag_;
 
-    bus& bus_;
+    Bus& bus_;
 
     struct instruction
     {
@@ -979,6 +997,34 @@ class cpu
       return result;
     }
 
+    // pushes the program counter and status flags and jumps to the address at the given vector location
+    void enter_interrupt(std::uint16_t vector_location)
+    {
+      // push the program counter to the stack
+      std::uint8_t low_pc_byte = static_cast<std::uint8_t>(program_counter_);
+      std::uint8_t high_pc_byte = program_counter_ >> 8;
+
+      push_stack(high_pc_byte);
+      push_stack(low_pc_byte);
+
+      std::uint8_t value = status_flags_as_byte();
+
+      // see https://www.nesdev.org/wiki/Status_flags#The_B_flag
+      value |= 0b00100000; // set bit 5
+      value &= 0b11101111; // clear bit 4
+
+      push_stack(value);
+
+      // disable interrupts
+      interrupt_request_disable_flag_ = true;
+
+      // read the new program counter from the vector location
+      low_pc_byte = read(vector_location);
+      high_pc_byte = read(vector_location + 1);
+      program_counter_ = (high_pc_byte << 8) | low_pc_byte;
+    }
+
+
     std::uint8_t status_flags_as_byte() const
     {
       // note that the unused "constant" flag (bit 5) is hardwired to on
@@ -1164,6 +1210,11 @@ class cpu
       execute_clear_flag(decimal_mode_flag_);
     }
 
+    void execute_clear_interrupt_disable()
+    {
+      execute_clear_flag(interrupt_request_disable_flag_);
+    }
+
     void execute_clear_overflow_flag()
     {
       execute_clear_flag(overflow_flag_);
@@ -2034,7 +2085,7 @@ class cpu
 
         case CLI:
         {
-          throw std::runtime_error("cpu::execute: CLI unimplemented");
+          execute_clear_interrupt_disable();
           break;
         }
 
@@ -2385,5 +2436,8 @@ class cpu
 };
 
 
+using cpu = basic_cpu<bus>;
+
+
 } // end nes
 
@@ -1,65 +1,31 @@
 #include "system.hpp"
-#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <functional>
 #include <iostream>
+#include <limits>
+#include <span>
 #include <thread>
+#include <vector>
 
 
 namespace nes
 {
 
 
-inline void emulate(class system& sys)
+// emulates as quickly as possible for the given number of frames
+// frames and audio are recorded by the system's capture, if one is attached
+inline void emulate(class system& sys, std::size_t num_frames = std::numeric_limits<std::size_t>::max())
 {
-  // this approach steps the cpu one instruction and then steps the ppu 3
-  // times as many cycles as the number of cpu cycles consumed
+  std::vector<float> audio_samples(system::max_audio_samples_per_frame);
 
-  std::size_t ppu_cycle = 0;
-  std::size_t cpu_cycle = sys.cpu().reset();
-  for(std::size_t i = 0; i < 3 * cpu_cycle; ++i)
-  {
-    sys.ppu().step_cycle();
-    ++ppu_cycle;
-  }
+  sys.reset();
 
   try
   {
-    while(true)
+    for(std::size_t frame = 0; frame < num_frames; ++frame)
     {
-      // log current cpu state
-      //sys.cpu().log(std::cout, cpu_cycle, ppu_cycle);
-
-      std::size_t num_cpu_cycles = 0;
-
-      if(sys.bus().dma_in_progress())
-      {
-        // the cpu is suspended during a dma
-        sys.bus().step_dma_cycle(cpu_cycle);
-        num_cpu_cycles = 1;
-      }
-      else
-      {
-        // execute the next instruction
-        num_cpu_cycles = sys.cpu().step_instruction();
-
-        // execute any nonmaskable interrupt
-        if(sys.ppu().nmi)
-        {
-          num_cpu_cycles += sys.cpu().nonmaskable_interrupt();
-          sys.ppu().nmi = false;
-        }
-      }
-
-      // let the ppu catch up to the cpu
-      for(std::size_t i = 0; i < 3 * num_cpu_cycles; ++i)
-      {
-        sys.ppu().step_cycle();
-        ++ppu_cycle;
-      }
-
-      cpu_cycle += num_cpu_cycles;
+      sys.run_frame(audio_samples);
     }
   }
   catch(std::exception& e)
@@ -69,31 +35,13 @@ inline void emulate(class system& sys)
 }
 
 
-inline void emulate(class system& sys, std::atomic<bool>& cancelled, std::atomic<bool>& paused, std::ostream& cpu_log, std::ostream& error_log, std::function<void(float)> audio = [](float){})
+inline void emulate(class system& sys, std::atomic<bool>& cancelled, std::atomic<bool>& paused, std::ostream& cpu_log, std::ostream& error_log, std::function<void(std::span<const float>)> audio = [](std::span<const float>){})
 {
-  // this approach steps the cpu one instruction and then steps the ppu 3
-  // times as many cycles as the number of cpu cycles consumed
-
   auto frame_began = std::chrono::high_resolution_clock::now();
 
-  float mean_audio_sample = 0;
-  std::size_t num_audio_samples = 0;
-  // XXX this corresponds to an audio sampling rate of 88200
-  std::array<std::size_t,4> samples_per_output = {20, 20, 20, 21};
-
-  std::size_t ppu_cycle = 0;
-  std::size_t cpu_cycle = sys.cpu().reset();
-
-  for(std::size_t i = 0; i < cpu_cycle; ++i)
-  {
-    sys.apu().step_cycle();
-  }
+  std::vector<float> audio_samples(system::max_audio_samples_per_frame);
 
-  for(std::size_t i = 0; i < 3 * cpu_cycle; ++i)
-  {
-    sys.ppu().step_cycle();
-    ++ppu_cycle;
-  }
+  sys.reset();
 
   try
   {
@@ -102,64 +50,19 @@ inline void emulate(class system& sys, std::atomic<bool>& cancelled, std::atomic
       // wait until unpaused
       paused.wait(true);
 
-      // log current cpu state
-      //sys.cpu().log(cpu_log, cpu_cycle, ppu_cycle);
-
-      std::size_t num_cpu_cycles = 0;
-
-      if(sys.bus().dma_in_progress())
-      {
-        // the cpu is suspended during a dma
-        sys.bus().step_dma_cycle(cpu_cycle);
-        num_cpu_cycles = 1;
-      }
-      else
-      {
-        // execute the next instruction
-        num_cpu_cycles = sys.cpu().step_instruction();
-
-        // execute any nonmaskable interrupt
-        if(sys.ppu().nmi)
-        {
-          num_cpu_cycles += sys.cpu().nonmaskable_interrupt();
-          sys.ppu().nmi = false;
-
-          auto frame_duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - frame_began);
-
-          if(frame_duration < std::chrono::microseconds(16667))
-          {
-            std::this_thread::sleep_for(std::chrono::microseconds(16667) - frame_duration);
-          }
-
-          frame_began = std::chrono::high_resolution_clock::now();
-        }
-      }
+      // emulate a frame and output its audio as a block
+      std::size_t num_audio_samples = sys.run_frame(audio_samples);
+      audio(std::span(audio_samples).first(num_audio_samples));
 
-      // let the apu catch up to the cpu
-      for(std::size_t i = 0; i < num_cpu_cycles; ++i)
-      {
-        sys.apu().step_cycle();
-        ++num_audio_samples;
-        mean_audio_sample += (sys.apu().sample() - mean_audio_sample)/num_audio_samples;
-
-        // output an audio sample every so often
-        if(num_audio_samples == samples_per_output.front())
-        {
-          audio(mean_audio_sample);
-          mean_audio_sample = 0;
-          num_audio_samples = 0;
-          std::rotate(samples_per_output.begin(), samples_per_output.begin() + 1, samples_per_output.end());
-        }
-      }
+      // pace the emulation to 60 frames per second
+      auto frame_duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - frame_began);
 
-      // let the ppu catch up to the cpu
-      for(std::size_t i = 0; i < 3 * num_cpu_cycles; ++i)
+      if(frame_duration < std::chrono::microseconds(16667))
       {
-        sys.ppu().step_cycle();
-        ++ppu_cycle;
+        std::this_thread::sleep_for(std::chrono::microseconds(16667) - frame_duration);
       }
 
-      cpu_cycle += num_cpu_cycles;
+      frame_began = std::chrono::high_resolution_clock::now();
     }
   }
   catch(std::exception& e)
@@ -170,4 +73,3 @@ inline void emulate(class system& sys, std::atomic<bool>& cancelled, std::atomic
 
 
 } // end nes
-
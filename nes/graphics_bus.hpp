@@ -1,6 +1,7 @@
 #pragma once
 
 #include "cartridge.hpp"
+#include <array>
 #include <cstdint>
 #include <fmt/format.h>
 #include <span>
@@ -19,38 +20,82 @@ class graphics_bus
     cartridge& cart_;
     std::span<std::uint8_t, 2*nametable_size> vram_;
 
-    inline std::uint16_t map_nametable_address(std::uint16_t address) const
-    {
-      // this bitwise AND does address mirroring
-      address &= 0x0FFF;
+    // maps each of the four logical nametables to a physical 1KB page of vram
+    std::array<std::uint8_t*,4> nametable_pages_;
+
+    // the state of address line 12, which mappers like the mmc3 watch
+    bool watching_a12_;
+    bool a12_;
 
-      // XXX it feels like the following calculation should be done by the mapper
+    // this is called whenever the cartridge's nametable mirroring changes
+    inline void map_nametables()
+    {
+      std::uint8_t* page_0 = vram_.data();
+      std::uint8_t* page_1 = vram_.data() + nametable_size;
 
-      if(cart_.nametable_mirroring() != cartridge::horizontal and cart_.nametable_mirroring() != cartridge::vertical)
+      switch(cart_.nametable_mirroring())
       {
-        throw std::runtime_error("graphics_bus::map_nametable_address: Unimplemented nametable mirroring kind");
+        case cartridge::horizontal:
+        {
+          nametable_pages_ = {page_0, page_0, page_1, page_1};
+          break;
+        }
+
+        case cartridge::vertical:
+        {
+          nametable_pages_ = {page_0, page_1, page_0, page_1};
+          break;
+        }
+
+        case cartridge::single_screen_lower:
+        {
+          nametable_pages_ = {page_0, page_0, page_0, page_0};
+          break;
+        }
+
+        case cartridge::single_screen_upper:
+        {
+          nametable_pages_ = {page_1, page_1, page_1, page_1};
+          break;
+        }
+
+        case cartridge::four_screen:
+        {
+          // the third and fourth nametables live on the cartridge
+          std::uint8_t* page_2 = cart_.four_screen_vram().data();
+          std::uint8_t* page_3 = page_2 + nametable_size;
+
+          nametable_pages_ = {page_0, page_1, page_2, page_3};
+          break;
+        }
+
+        default:
+        {
+          throw std::runtime_error("graphics_bus::map_nametables: Unimplemented nametable mirroring kind");
+        }
       }
+    }
 
-      // to find the index of the logical nametable, just divide the address by the nametable size
-      int logical_nametable_idx = address / nametable_size;
-
-      // map the logical index in [0,4) to the physical index in [0,2) based on the nametable mirroring mode
-      int physical_nametable_idx = (cart_.nametable_mirroring() == cartridge::horizontal) ?
-        logical_nametable_idx / 2 :
-        logical_nametable_idx % 2
-      ;
-
-      // the index of the byte in vram is simply the address modulo nametable size
-      int byte_idx = address % nametable_size;
-
-      return physical_nametable_idx * nametable_size + byte_idx;
+    inline std::uint8_t& nametable_byte(std::uint16_t address) const
+    {
+      // bits 10 & 11 select the logical nametable and the low 10 bits select the byte within it
+      return nametable_pages_[(address >> 10) & 0b11][address & (nametable_size - 1)];
     }
 
   public:
     graphics_bus(cartridge& cart, std::span<std::uint8_t, 2*nametable_size> vram)
       : cart_{cart},
-        vram_{vram}
-    {}
+        vram_{vram},
+        nametable_pages_{},
+        watching_a12_{cart.watches_a12()},
+        a12_{false}
+    {
+      map_nametables();
+      cart_.on_nametable_mirroring_changed([this]
+      {
+        map_nametables();
+      });
+    }
 
     inline std::uint8_t read(std::uint16_t address) const
     {
@@ -64,7 +109,7 @@ class graphics_bus
       else if(0x2000 <= address and address < 0x3F00)
       {
         // nametables
-        result = vram_[map_nametable_address(address)];
+        result = nametable_byte(address);
       }
       else
       {
@@ -74,12 +119,64 @@ class graphics_bus
       return result;
     }
 
+    // the ppu calls this with each address which the cpu puts on the bus through the ppu's registers, outside of rendering
+    // the mmc3 ignores a rise of a12 which follows a low of fewer than about three cpu cycles, as happens between
+    // fetches while rendering. this doesn't filter, because the address only changes on a write to 0x2006 or an access
+    // to 0x2007, which are each the last cycle of an instruction of at least four cycles, so a12 is always low for
+    // at least four cpu cycles before it rises here
+    // see https://www.nesdev.org/wiki/MMC3#IRQ_Specifics
+    inline void watch_a12(std::uint16_t address)
+    {
+      bool a12 = address & 0x1000;
+
+      if(watching_a12_ and a12 and not a12_)
+      {
+        cart_.a12_rose();
+      }
+
+      a12_ = a12;
+    }
+
+    // while rendering, a12 toggles with the pattern table fetches, and at most one rise per scanline gets past the mmc3's filter
+    // rather than reporting each of its fetches, the renderer calls this on the cycle of that rise
+    inline void a12_rose_while_rendering()
+    {
+      if(watching_a12_)
+      {
+        cart_.a12_rose();
+      }
+
+      // each scanline ends with nametable fetches, which leave a12 low
+      a12_ = false;
+    }
+
+    inline bool watching_a12() const
+    {
+      return watching_a12_;
+    }
+
+    // returns which tiles of the pattern tables have changed since the dirty tiles were last cleared
+    inline const cartridge::pattern_tile_mask& dirty_tiles() const
+    {
+      return cart_.dirty_tiles();
+    }
+
+    inline void clear_dirty_tiles()
+    {
+      cart_.clear_dirty_tiles();
+    }
+
     inline void write(std::uint16_t address, std::uint8_t data)
     {
-      if(0x2000 <= address and address < 0x3F00)
+      if(0x0000 <= address and address < 0x2000)
+      {
+        // cartridge CHR memory
+        cart_.graphics_write(address, data);
+      }
+      else if(0x2000 <= address and address < 0x3F00)
       {
         // nametables
-        vram_[map_nametable_address(address)] = data;
+        nametable_byte(address) = data;
       }
       else
       {
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+
+namespace nes
+{
+
+
+// returns the CRC-32 of the given bytes, as used by ROM databases, zip and zlib
+// see https://www.nesdev.org/wiki/NES_2.0_XML_Database
+//
+// this uses slicing-by-8, which consumes eight bytes per step with eight table lookups that don't depend on each other,
+// rather than one byte per step with lookups that each wait on the previous one
+inline std::uint32_t crc32(std::span<const std::uint8_t> bytes)
+{
+  using table = std::array<std::array<std::uint32_t,256>,8>;
+
+  constexpr static table tables = []
+  {
+    table result{};
+
+    // the reflected polynomial of CRC-32
+    constexpr std::uint32_t polynomial = 0xEDB88320;
+
+    for(std::uint32_t i = 0; i < 256; ++i)
+    {
+      std::uint32_t crc = i;
+      for(int bit = 0; bit < 8; ++bit)
+      {
+        crc = (crc >> 1) ^ ((crc & 1) ? polynomial : 0);
+      }
+
+      result[0][i] = crc;
+    }
+
+    // tables[k][i] is the crc of byte i followed by k zero bytes
+    for(int k = 1; k < 8; ++k)
+    {
+      for(std::uint32_t i = 0; i < 256; ++i)
+      {
+        result[k][i] = (result[k-1][i] >> 8) ^ result[0][result[k-1][i] & 0xFF];
+      }
+    }
+
+    return result;
+  }();
+
+  std::uint32_t crc = 0xFFFFFFFF;
+  const std::uint8_t* p = bytes.data();
+  std::size_t n = bytes.size();
+
+  for(; n >= 8; p += 8, n -= 8)
+  {
+    std::uint32_t low = (p[0] | (p[1] << 8) | (p[2] << 16) | (std::uint32_t(p[3]) << 24)) ^ crc;
+    std::uint32_t high = p[4] | (p[5] << 8) | (p[6] << 16) | (std::uint32_t(p[7]) << 24);
+
+    crc = tables[7][low & 0xFF] ^ tables[6][(low >> 8) & 0xFF] ^ tables[5][(low >> 16) & 0xFF] ^ tables[4][low >> 24] ^
+          tables[3][high & 0xFF] ^ tables[2][(high >> 8) & 0xFF] ^ tables[1][(high >> 16) & 0xFF] ^ tables[0][high >> 24];
+  }
+
+  for(; n > 0; ++p, --n)
+  {
+    crc = (crc >> 8) ^ tables[0][(crc ^ *p) & 0xFF];
+  }
+
+  return ~crc;
+}
+
+
+// returns the SHA-1 digest of the given bytes
+// see https://datatracker.ietf.org/doc/html/rfc3174
+inline std::array<std::uint8_t,20> sha1(std::span<const std::uint8_t> bytes)
+{
+  std::array<std::uint32_t,5> h = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+
+  // processes one 64B block
+  auto compress = [&h](const std::uint8_t* block)
+  {
+    std::array<std::uint32_t,80> w;
+    for(int i = 0; i < 16; ++i)
+    {
+      w[i] = (std::uint32_t(block[4*i]) << 24) | (block[4*i + 1] << 16) | (block[4*i + 2] << 8) | block[4*i + 3];
+    }
+
+    for(int i = 16; i < 80; ++i)
+    {
+      w[i] = std::rotl(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+    }
+
+    std::uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+
+    // the rounds are in four groups of 20, which differ only in f and k
+    auto round = [&](std::uint32_t f, std::uint32_t k, std::uint32_t w)
+    {
+      std::uint32_t temp = std::rotl(a, 5) + f + e + k + w;
+      e = d;
+      d = c;
+      c = std::rotl(b, 30);
+      b = a;
+      a = temp;
+    };
+
+    for(int i = 0; i < 20; ++i) round((b & c) | (~b & d), 0x5A827999, w[i]);
+    for(int i = 20; i < 40; ++i) round(b ^ c ^ d, 0x6ED9EBA1, w[i]);
+    for(int i = 40; i < 60; ++i) round((b & c) | (b & d) | (c & d), 0x8F1BBCDC, w[i]);
+    for(int i = 60; i < 80; ++i) round(b ^ c ^ d, 0xCA62C1D6, w[i]);
+
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+  };
+
+  std::size_t num_whole_blocks = bytes.size() / 64;
+  for(std::size_t i = 0; i < num_whole_blocks; ++i)
+  {
+    compress(bytes.data() + 64 * i);
+  }
+
+  // the message is padded with a one bit, zeros, and its length in bits, which may take one more block
+  std::array<std::uint8_t,128> tail{};
+  std::size_t tail_size = bytes.size() - 64 * num_whole_blocks;
+  std::memcpy(tail.data(), bytes.data() + 64 * num_whole_blocks, tail_size);
+  tail[tail_size] = 0x80;
+
+  std::size_t padded_size = tail_size < 56 ? 64 : 128;
+  std::uint64_t num_bits = std::uint64_t{bytes.size()} * 8;
+  for(int i = 0; i < 8; ++i)
+  {
+    tail[padded_size - 1 - i] = num_bits >> (8 * i);
+  }
+
+  for(std::size_t offset = 0; offset < padded_size; offset += 64)
+  {
+    compress(tail.data() + offset);
+  }
+
+  std::array<std::uint8_t,20> result;
+  for(int i = 0; i < 5; ++i)
+  {
+    result[4*i + 0] = h[i] >> 24;
+    result[4*i + 1] = h[i] >> 16;
+    result[4*i + 2] = h[i] >> 8;
+    result[4*i + 3] = h[i];
+  }
+
+  return result;
+}
+
+
+} // end nes
+
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstdint>
+#include <fcntl.h>
+#include <filesystem>
+#include <fmt/format.h>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+
+namespace nes
+{
+
+
+// mapped_file is a file mapped into memory
+// the file stays open and mapped until the mapped_file is destroyed
+class mapped_file
+{
+  public:
+    inline mapped_file()
+      : fd_{-1},
+        data_{nullptr},
+        size_{0}
+    {}
+
+    // maps the whole of an existing file for reading
+    inline static mapped_file open(const std::filesystem::path& filename)
+    {
+      mapped_file result{filename, O_RDONLY};
+      result.map(result.file_size(), PROT_READ, MAP_PRIVATE);
+      return result;
+    }
+
+    // maps the first size bytes of a file for reading and writing, creating the file or extending it with zeros as needed
+    // writes are shared with the os, which writes the modified pages back to the file in the background
+    //
+    // the writer holds an exclusive lock on the file until the mapped_file is destroyed, since two writers would
+    // silently overwrite each other's changes. returns nothing if another writer, in this process or another, holds it
+    inline static std::optional<mapped_file> try_open_writable(const std::filesystem::path& filename, std::size_t size)
+    {
+      mapped_file result{filename, O_RDWR | O_CREAT};
+
+      if(flock(result.fd_, LOCK_EX | LOCK_NB) != 0)
+      {
+        return std::nullopt;
+      }
+
+      if(result.file_size() < size and ftruncate(result.fd_, size) != 0)
+      {
+        throw std::runtime_error(fmt::format("mapped_file::try_open_writable: Couldn't resize {}", filename.string()));
+      }
+
+      result.map(size, PROT_READ | PROT_WRITE, MAP_SHARED);
+      return result;
+    }
+
+    inline ~mapped_file()
+    {
+      if(data_)
+      {
+        munmap(data_, size_);
+      }
+
+      if(fd_ >= 0)
+      {
+        ::close(fd_);
+      }
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    inline mapped_file(mapped_file&& other)
+      : fd_{std::exchange(other.fd_, -1)},
+        data_{std::exchange(other.data_, nullptr)},
+        size_{std::exchange(other.size_, 0)}
+    {}
+
+    inline mapped_file& operator=(mapped_file&& other)
+    {
+      std::swap(fd_, other.fd_);
+      std::swap(data_, other.data_);
+      std::swap(size_, other.size_);
+      return *this;
+    }
+
+    inline std::span<const std::uint8_t> bytes() const
+    {
+      return {data_, size_};
+    }
+
+    // only files opened with try_open_writable may be written
+    inline std::span<std::uint8_t> writable_bytes() const
+    {
+      return {data_, size_};
+    }
+
+  private:
+    inline mapped_file(const std::filesystem::path& filename, int flags)
+      : fd_{::open(filename.c_str(), flags, 0644)},
+        data_{nullptr},
+        size_{0}
+    {
+      if(fd_ < 0)
+      {
+        throw std::runtime_error(fmt::format("mapped_file: Couldn't open {}", filename.string()));
+      }
+    }
+
+    inline std::size_t file_size() const
+    {
+      struct stat status;
+      if(fstat(fd_, &status) != 0)
+      {
+        throw std::runtime_error("mapped_file::file_size: Couldn't stat file");
+      }
+
+      return status.st_size;
+    }
+
+    inline void map(std::size_t size, int protection, int flags)
+    {
+      // an empty file has nothing to map
+      if(size == 0) return;
+
+      void* mapping = mmap(nullptr, size, protection, flags, fd_, 0);
+      if(mapping == MAP_FAILED)
+      {
+        throw std::runtime_error("mapped_file::map: Couldn't map file");
+      }
+
+      data_ = static_cast<std::uint8_t*>(mapping);
+      size_ = size;
+    }
+
+    int fd_;
+    std::uint8_t* data_;
+    std::size_t size_;
+};
+
+
+} // end nes
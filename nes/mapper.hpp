@@ -0,0 +1,633 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <fmt/format.h>
+#include <functional>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+
+namespace nes
+{
+
+
+// a mapper is the circuitry on a cartridge which connects the cpu's and the ppu's address spaces to the cartridge's memory
+// see https://www.nesdev.org/wiki/Mapper
+//
+// rather than translating each address as it is accessed, a mapper points each 8KB slot of the cpu's address space
+// and each 1KB slot of the ppu's pattern tables at the memory which currently backs it. the pointers only change
+// when a game writes to one of the mapper's registers, so reads are a lookup and an add
+class mapper
+{
+  public:
+    // see https://www.nesdev.org/wiki/Mirroring#Nametable_Mirroring
+    enum nametable_mirroring_kind
+    {
+      horizontal, vertical, single_screen_lower, single_screen_upper, four_screen
+    };
+
+    constexpr static std::size_t prg_slot_size = 8192;
+    constexpr static std::size_t chr_slot_size = 1024;
+
+    inline mapper(std::span<const std::uint8_t> prg_rom, std::span<const std::uint8_t> chr_memory, std::span<std::uint8_t> prg_ram, nametable_mirroring_kind mirroring)
+      : prg_rom_{prg_rom},
+        chr_memory_{chr_memory},
+        prg_ram_{prg_ram},
+        interrupt_request_{false},
+        watches_a12_{false},
+        prg_ram_writable_{false},
+        nametable_mirroring_{mirroring}
+    {
+      prg_slots_.fill(open_bus_.data());
+      chr_slots_.fill(open_bus_.data());
+    }
+
+    virtual ~mapper() = default;
+
+    mapper(const mapper&) = delete;
+    mapper& operator=(const mapper&) = delete;
+
+    // addresses below 0x4020 don't belong to the cartridge, so they are never read here
+    inline std::uint8_t read(std::uint16_t address) const
+    {
+      return prg_slots_[address >> 13][address & (prg_slot_size - 1)];
+    }
+
+    // address must be below 0x2000
+    inline std::uint8_t graphics_read(std::uint16_t address) const
+    {
+      return chr_slots_[address >> 10][address & (chr_slot_size - 1)];
+    }
+
+    // returns the offset into chr memory which the pattern table address is mapped to
+    // address must be below 0x2000
+    inline std::size_t chr_offset(std::uint16_t address) const
+    {
+      return (chr_slots_[address >> 10] - chr_memory_.data()) + (address & (chr_slot_size - 1));
+    }
+
+    inline void write(std::uint16_t address, std::uint8_t value)
+    {
+      if(address >= 0x8000)
+      {
+        write_register(address, value);
+      }
+      else if(address >= 0x6000 and prg_ram_writable_)
+      {
+        prg_ram_[address & (prg_slot_size - 1)] = value;
+      }
+
+      // writes anywhere else have no effect
+    }
+
+    inline nametable_mirroring_kind nametable_mirroring() const
+    {
+      return nametable_mirroring_;
+    }
+
+    // returns whether or not the mapper is asserting the cpu's interrupt request line
+    inline bool interrupt_request() const
+    {
+      return interrupt_request_;
+    }
+
+    // returns whether or not the mapper counts rising edges of address line 12 of the ppu's bus
+    inline bool watches_a12() const
+    {
+      return watches_a12_;
+    }
+
+    // the graphics bus calls this for each rising edge of a12 which gets past the mapper's filter
+    // see graphics_bus::watch_a12
+    virtual void a12_rose() {}
+
+    // f is called before anything which the ppu reads through the mapper changes, i.e. chr banks or nametable mirroring
+    inline void on_graphics_changing(std::function<void()> f)
+    {
+      graphics_changing_ = f;
+    }
+
+    // f is called after nametable mirroring changes
+    inline void on_nametable_mirroring_changed(std::function<void()> f)
+    {
+      nametable_mirroring_changed_ = f;
+    }
+
+  protected:
+    // handles a write to 0x8000 and above
+    virtual void write_register(std::uint16_t address, std::uint8_t value) = 0;
+
+    inline std::size_t num_prg_rom_banks(std::size_t bank_size) const
+    {
+      return std::max<std::size_t>(1, prg_rom_.size() / bank_size);
+    }
+
+    // points the slots covering [address, address + bank_size) at a bank of prg rom
+    // banks are numbered in units of bank_size, and banks past the end of prg rom wrap around to its beginning
+    inline void map_prg_rom(std::uint16_t address, std::size_t bank_size, std::size_t bank)
+    {
+      std::size_t offset = bank * bank_size;
+
+      for(std::size_t i = 0; i < bank_size / prg_slot_size; ++i)
+      {
+        prg_slots_[(address >> 13) + i] = prg_rom_.data() + (offset + i * prg_slot_size) % prg_rom_.size();
+      }
+    }
+
+    // points the slot at address at 8KB of memory other than prg rom
+    inline void map_prg_slot(std::uint16_t address, const std::uint8_t* memory)
+    {
+      prg_slots_[address >> 13] = memory;
+    }
+
+    // maps prg ram, if the cartridge has any, to 0x6000 - 0x7FFF
+    inline void map_prg_ram(bool enabled, bool writable)
+    {
+      enabled = enabled and not prg_ram_.empty();
+
+      prg_slots_[0x6000 >> 13] = enabled ? prg_ram_.data() : open_bus_.data();
+      prg_ram_writable_ = enabled and writable;
+    }
+
+    // points the slots covering [address, address + bank_size) of the pattern tables at a bank of chr memory
+    // banks are numbered in units of bank_size, and banks past the end of chr memory wrap around to its beginning
+    inline void map_chr(std::uint16_t address, std::size_t bank_size, std::size_t bank)
+    {
+      std::size_t offset = bank * bank_size;
+      std::size_t first_slot = address >> 10;
+      std::size_t num_slots = bank_size / chr_slot_size;
+
+      std::array<const std::uint8_t*,8> slots = chr_slots_;
+      for(std::size_t i = 0; i < num_slots; ++i)
+      {
+        slots[first_slot + i] = chr_memory_.data() + (offset + i * chr_slot_size) % chr_memory_.size();
+      }
+
+      // games often write the same banks again, which doesn't change the image
+      if(slots != chr_slots_)
+      {
+        notify_graphics_changing();
+        chr_slots_ = slots;
+      }
+    }
+
+    inline void set_nametable_mirroring(nametable_mirroring_kind mirroring)
+    {
+      // four-screen cartridges are wired for four-screen mirroring regardless of what the mapper selects
+      if(nametable_mirroring_ == four_screen) return;
+
+      if(mirroring != nametable_mirroring_)
+      {
+        notify_graphics_changing();
+        nametable_mirroring_ = mirroring;
+
+        if(nametable_mirroring_changed_)
+        {
+          nametable_mirroring_changed_();
+        }
+      }
+    }
+
+    std::span<const std::uint8_t> prg_rom_;
+    std::span<const std::uint8_t> chr_memory_;
+    std::span<std::uint8_t> prg_ram_;
+
+    bool interrupt_request_;
+    bool watches_a12_;
+
+  private:
+    inline void notify_graphics_changing()
+    {
+      if(graphics_changing_)
+      {
+        graphics_changing_();
+      }
+    }
+
+    // unmapped slots point here
+    // see https://www.nesdev.org/wiki/Open_bus_behavior
+    // XXX what we do here does not model the actual NES behavior
+    // per that webpage, on an actual NES, reading an open bus repeats the
+    // last value that was read on the bus before this read
+    // instead, we'll just return 0
+    // to model the NES behavior, we'd need some extra state in the bus class
+    // to remember the previous value returned from bus::read and return that
+    // in an open bus case
+    constexpr static std::array<std::uint8_t, prg_slot_size> open_bus_{};
+
+    std::array<const std::uint8_t*,8> prg_slots_;
+    std::array<const std::uint8_t*,8> chr_slots_;
+    bool prg_ram_writable_;
+
+    nametable_mirroring_kind nametable_mirroring_;
+    std::function<void()> graphics_changing_;
+    std::function<void()> nametable_mirroring_changed_;
+};
+
+
+// see https://www.nesdev.org/wiki/NROM
+class nrom : public mapper
+{
+  public:
+    inline nrom(std::span<const std::uint8_t> prg_rom, std::span<const std::uint8_t> chr_memory, std::span<std::uint8_t> prg_ram, nametable_mirroring_kind mirroring)
+      : mapper{prg_rom, chr_memory, prg_ram, mirroring}
+    {
+      // a single 16KB bank is mirrored into both halves
+      map_prg_rom(0x8000, 0x8000, 0);
+      map_chr(0x0000, 0x2000, 0);
+    }
+
+  protected:
+    inline void write_register(std::uint16_t address, std::uint8_t value) override
+    {
+      // nrom has no registers
+
+      // XXX this hack allows us to override the reset vector while debugging
+      //     prg rom is shared and read-only, so the bank containing the vectors is copied before it's modified
+      if(address == 0xFFFC or address == 0xFFFD)
+      {
+        if(patched_bank_.empty())
+        {
+          for(std::uint16_t i = 0; i < prg_slot_size; ++i)
+          {
+            patched_bank_.push_back(read(0xE000 + i));
+          }
+
+          map_prg_slot(0xE000, patched_bank_.data());
+        }
+
+        patched_bank_[address & (prg_slot_size - 1)] = value;
+      }
+    }
+
+  private:
+    std::vector<std::uint8_t> patched_bank_;
+};
+
+
+// see https://www.nesdev.org/wiki/MMC1
+class mmc1 : public mapper
+{
+  public:
+    inline mmc1(std::span<const std::uint8_t> prg_rom, std::span<const std::uint8_t> chr_memory, std::span<std::uint8_t> prg_ram, nametable_mirroring_kind mirroring)
+      : mapper{prg_rom, chr_memory, prg_ram, mirroring},
+        shift_register_{empty_shift_register},
+        control_{0x0C},
+        chr_bank_0_{0},
+        chr_bank_1_{0},
+        prg_bank_{0}
+    {
+      update_banks();
+    }
+
+  protected:
+    inline void write_register(std::uint16_t address, std::uint8_t value) override
+    {
+      // XXX the mmc1 ignores a write on the cpu cycle following another write, which some games rely on
+      //     the cpu's read-modify-write instructions do this, but we don't know the cycle of each write here
+
+      if(value & 0x80)
+      {
+        // reset the shift register and fix the last prg bank at 0xC000
+        shift_register_ = empty_shift_register;
+        control_ |= 0x0C;
+        update_banks();
+        return;
+      }
+
+      // registers are written serially, one bit at a time, beginning with the lsb
+      // the marker bit reaches bit 0 when the fifth bit is shifted in
+      bool fifth_bit = shift_register_ & 0x01;
+      shift_register_ = (shift_register_ >> 1) | ((value & 0x01) << 4);
+
+      if(fifth_bit)
+      {
+        // bits 13 & 14 of the address of the fifth write select the register
+        switch((address >> 13) & 0b11)
+        {
+          case 0: control_    = shift_register_; break;
+          case 1: chr_bank_0_ = shift_register_; break;
+          case 2: chr_bank_1_ = shift_register_; break;
+          case 3: prg_bank_   = shift_register_; break;
+        }
+
+        shift_register_ = empty_shift_register;
+        update_banks();
+      }
+    }
+
+  private:
+    constexpr static std::uint8_t empty_shift_register = 0x10;
+
+    inline void update_banks()
+    {
+      constexpr nametable_mirroring_kind mirrorings[] = {single_screen_lower, single_screen_upper, vertical, horizontal};
+      set_nametable_mirroring(mirrorings[control_ & 0b11]);
+
+      if(control_ & 0x10)
+      {
+        // two 4KB chr banks
+        map_chr(0x0000, 0x1000, chr_bank_0_);
+        map_chr(0x1000, 0x1000, chr_bank_1_);
+      }
+      else
+      {
+        // one 8KB chr bank, ignoring the low bit
+        map_chr(0x0000, 0x2000, chr_bank_0_ >> 1);
+      }
+
+      // 512KB boards (SUROM) select which 256KB half of prg rom to use with bit 4 of the chr bank
+      std::size_t outer_bank = prg_rom_.size() > 0x40000 ? (chr_bank_0_ & 0x10) : 0;
+      std::size_t bank = outer_bank | (prg_bank_ & 0x0F);
+
+      switch((control_ >> 2) & 0b11)
+      {
+        case 0:
+        case 1:
+        {
+          // one 32KB bank, ignoring the low bit
+          map_prg_rom(0x8000, 0x8000, bank >> 1);
+          break;
+        }
+
+        case 2:
+        {
+          // the first bank is fixed at 0x8000
+          map_prg_rom(0x8000, 0x4000, outer_bank);
+          map_prg_rom(0xC000, 0x4000, bank);
+          break;
+        }
+
+        case 3:
+        {
+          // the last bank is fixed at 0xC000
+          map_prg_rom(0x8000, 0x4000, bank);
+          map_prg_rom(0xC000, 0x4000, outer_bank | 0x0F);
+          break;
+        }
+      }
+
+      // bit 4 of the prg bank disables prg ram
+      map_prg_ram(not (prg_bank_ & 0x10), true);
+    }
+
+    std::uint8_t shift_register_;
+    std::uint8_t control_;
+    std::uint8_t chr_bank_0_;
+    std::uint8_t chr_bank_1_;
+    std::uint8_t prg_bank_;
+};
+
+
+// see https://www.nesdev.org/wiki/UxROM
+class uxrom : public mapper
+{
+  public:
+    inline uxrom(std::span<const std::uint8_t> prg_rom, std::span<const std::uint8_t> chr_memory, std::span<std::uint8_t> prg_ram, nametable_mirroring_kind mirroring)
+      : mapper{prg_rom, chr_memory, prg_ram, mirroring}
+    {
+      // the last bank is fixed at 0xC000
+      map_prg_rom(0x8000, 0x4000, 0);
+      map_prg_rom(0xC000, 0x4000, num_prg_rom_banks(0x4000) - 1);
+      map_chr(0x0000, 0x2000, 0);
+    }
+
+  protected:
+    inline void write_register(std::uint16_t, std::uint8_t value) override
+    {
+      map_prg_rom(0x8000, 0x4000, value);
+    }
+};
+
+
+// see https://www.nesdev.org/wiki/CNROM
+class cnrom : public mapper
+{
+  public:
+    inline cnrom(std::span<const std::uint8_t> prg_rom, std::span<const std::uint8_t> chr_memory, std::span<std::uint8_t> prg_ram, nametable_mirroring_kind mirroring)
+      : mapper{prg_rom, chr_memory, prg_ram, mirroring}
+    {
+      map_prg_rom(0x8000, 0x8000, 0);
+      map_chr(0x0000, 0x2000, 0);
+    }
+
+  protected:
+    inline void write_register(std::uint16_t, std::uint8_t value) override
+    {
+      map_chr(0x0000, 0x2000, value);
+    }
+};
+
+
+// see https://www.nesdev.org/wiki/AxROM
+class axrom : public mapper
+{
+  public:
+    inline axrom(std::span<const std::uint8_t> prg_rom, std::span<const std::uint8_t> chr_memory, std::span<std::uint8_t> prg_ram, nametable_mirroring_kind mirroring)
+      : mapper{prg_rom, chr_memory, prg_ram, mirroring}
+    {
+      map_prg_rom(0x8000, 0x8000, 0);
+      map_chr(0x0000, 0x2000, 0);
+      set_nametable_mirroring(single_screen_lower);
+    }
+
+  protected:
+    inline void write_register(std::uint16_t, std::uint8_t value) override
+    {
+      map_prg_rom(0x8000, 0x8000, value & 0x07);
+      set_nametable_mirroring((value & 0x10) ? single_screen_upper : single_screen_lower);
+    }
+};
+
+
+// see https://www.nesdev.org/wiki/MMC3
+class mmc3 : public mapper
+{
+  public:
+    inline mmc3(std::span<const std::uint8_t> prg_rom, std::span<const std::uint8_t> chr_memory, std::span<std::uint8_t> prg_ram, nametable_mirroring_kind mirroring)
+      : mapper{prg_rom, chr_memory, prg_ram, mirroring},
+        bank_select_{0},
+        bank_registers_{0, 2, 4, 5, 6, 7, 0, 1},
+        irq_latch_{0},
+        irq_counter_{0},
+        irq_reload_{false},
+        irq_enabled_{false}
+    {
+      update_banks();
+      map_prg_ram(true, true);
+      watches_a12_ = true;
+    }
+
+    // the scanline counter is clocked by rising edges of a12, which occur once per scanline while the ppu renders
+    // with background and sprites in different pattern tables
+    // see https://www.nesdev.org/wiki/MMC3#IRQ_Specifics
+    inline void a12_rose() override
+    {
+      if(irq_counter_ == 0 or irq_reload_)
+      {
+        irq_counter_ = irq_latch_;
+        irq_reload_ = false;
+      }
+      else
+      {
+        --irq_counter_;
+      }
+
+      if(irq_counter_ == 0 and irq_enabled_)
+      {
+        interrupt_request_ = true;
+      }
+    }
+
+  protected:
+    inline void write_register(std::uint16_t address, std::uint8_t value) override
+    {
+      // registers are selected by bits 13 & 14 of the address and whether it is even or odd
+      bool odd = address & 0x01;
+
+      switch(address & 0xE000)
+      {
+        case 0x8000:
+        {
+          if(odd)
+          {
+            bank_registers_[bank_select_ & 0b111] = value;
+          }
+          else
+          {
+            bank_select_ = value;
+          }
+
+          update_banks();
+          break;
+        }
+
+        case 0xA000:
+        {
+          if(odd)
+          {
+            // bit 7 enables prg ram and bit 6 protects it from writes
+            map_prg_ram(value & 0x80, not (value & 0x40));
+          }
+          else
+          {
+            set_nametable_mirroring((value & 0x01) ? horizontal : vertical);
+          }
+
+          break;
+        }
+
+        case 0xC000:
+        {
+          if(odd)
+          {
+            // the counter reloads from the latch at the next clock
+            irq_counter_ = 0;
+            irq_reload_ = true;
+          }
+          else
+          {
+            irq_latch_ = value;
+          }
+
+          break;
+        }
+
+        case 0xE000:
+        {
+          irq_enabled_ = odd;
+
+          // disabling interrupts also acknowledges any pending interrupt
+          if(not irq_enabled_)
+          {
+            interrupt_request_ = false;
+          }
+
+          break;
+        }
+      }
+    }
+
+  private:
+    inline void update_banks()
+    {
+      std::size_t last_bank = num_prg_rom_banks(0x2000) - 1;
+
+      // bit 6 of bank select swaps the banks at 0x8000 and 0xC000
+      std::uint16_t r6_address = (bank_select_ & 0x40) ? 0xC000 : 0x8000;
+      std::uint16_t second_to_last_address = r6_address ^ 0x4000;
+
+      map_prg_rom(r6_address, 0x2000, bank_registers_[6]);
+      map_prg_rom(0xA000, 0x2000, bank_registers_[7]);
+      map_prg_rom(second_to_last_address, 0x2000, last_bank - 1);
+      map_prg_rom(0xE000, 0x2000, last_bank);
+
+      // bit 7 of bank select swaps the two 2KB banks with the four 1KB banks
+      std::uint16_t inversion = (bank_select_ & 0x80) ? 0x1000 : 0x0000;
+
+      // the 2KB banks ignore the low bit of their registers
+      map_chr(0x0000 ^ inversion, 0x0800, bank_registers_[0] >> 1);
+      map_chr(0x0800 ^ inversion, 0x0800, bank_registers_[1] >> 1);
+      map_chr(0x1000 ^ inversion, 0x0400, bank_registers_[2]);
+      map_chr(0x1400 ^ inversion, 0x0400, bank_registers_[3]);
+      map_chr(0x1800 ^ inversion, 0x0400, bank_registers_[4]);
+      map_chr(0x1C00 ^ inversion, 0x0400, bank_registers_[5]);
+    }
+
+    std::uint8_t bank_select_;
+    std::array<std::uint8_t,8> bank_registers_;
+
+    std::uint8_t irq_latch_;
+    std::uint8_t irq_counter_;
+    bool irq_reload_;
+    bool irq_enabled_;
+};
+
+
+// a function which makes a mapper of some type
+using mapper_factory = std::unique_ptr<mapper>(*)(std::span<const std::uint8_t> prg_rom, std::span<const std::uint8_t> chr_memory, std::span<std::uint8_t> prg_ram, mapper::nametable_mirroring_kind mirroring);
+
+template<class M>
+inline std::unique_ptr<mapper> make_mapper_of_type(std::span<const std::uint8_t> prg_rom, std::span<const std::uint8_t> chr_memory, std::span<std::uint8_t> prg_ram, mapper::nametable_mirroring_kind mirroring)
+{
+  return std::make_unique<M>(prg_rom, chr_memory, prg_ram, mirroring);
+}
+
+// the mappers which are implemented, by iNES mapper number
+inline constexpr std::array<std::pair<int,mapper_factory>,6> supported_mappers = {{
+  {0, make_mapper_of_type<nrom>},
+  {1, make_mapper_of_type<mmc1>},
+  {2, make_mapper_of_type<uxrom>},
+  {3, make_mapper_of_type<cnrom>},
+  {4, make_mapper_of_type<mmc3>},
+  {7, make_mapper_of_type<axrom>},
+}};
+
+
+// returns whether or not make_mapper can make the mapper with the given id
+inline bool mapper_supported(int id)
+{
+  return std::any_of(supported_mappers.begin(), supported_mappers.end(), [id](const auto& m) { return m.first == id; });
+}
+
+
+// returns the mapper with the given iNES mapper number
+inline std::unique_ptr<mapper> make_mapper(int id, std::span<const std::uint8_t> prg_rom, std::span<const std::uint8_t> chr_memory, std::span<std::uint8_t> prg_ram, mapper::nametable_mirroring_kind mirroring)
+{
+  auto found = std::find_if(supported_mappers.begin(), supported_mappers.end(), [id](const auto& m) { return m.first == id; });
+  if(found == supported_mappers.end())
+  {
+    throw std::runtime_error(fmt::format("make_mapper: ROM requires unsupported mapper {}", id));
+  }
+
+  return found->second(prg_rom, chr_memory, prg_ram, mirroring);
+}
+
+
+} // end nes
+
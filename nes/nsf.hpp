@@ -0,0 +1,455 @@
+#pragma once
+
+#include "apu.hpp"
+#include "cpu.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <fmt/format.h>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+namespace nes
+{
+
+
+// see https://www.nesdev.org/wiki/NSF#Header_Overview
+struct nsf_file_header
+{
+  char name[5];
+  std::uint8_t version;
+  std::uint8_t num_songs;
+  std::uint8_t starting_song;
+  std::uint16_t load_address;
+  std::uint16_t init_address;
+  std::uint16_t play_address;
+  char song_name[32];
+  char artist[32];
+  char copyright[32];
+  std::uint16_t ntsc_play_speed;
+  std::uint8_t initial_banks[8];
+  std::uint16_t pal_play_speed;
+  std::uint8_t region_flags;
+  std::uint8_t expansion_sound_flags;
+  std::uint8_t reserved[4];
+
+  inline nsf_file_header(std::istream& is)
+  {
+    is.read(reinterpret_cast<char*>(this), sizeof(nsf_file_header));
+
+    if(not is or not std::equal(name, name + 5, "NESM\x1A"))
+    {
+      throw std::runtime_error("nsf_file_header: Not an NSF file");
+    }
+  }
+
+  // "if any of the bankswitch init values are non-zero, the NSF uses bankswitching"
+  inline bool uses_bankswitching() const
+  {
+    return std::any_of(initial_banks, initial_banks + 8, [](std::uint8_t bank) { return bank != 0; });
+  }
+};
+
+static_assert(sizeof(nsf_file_header) == 0x80, "nsf_file_header must match the layout of the file");
+
+
+// nsf_bus is the memory map seen by an nsf's code
+// there is no ppu or cartridge: just ram, the apu, and 4KB banks of the nsf's data
+// see https://www.nesdev.org/wiki/NSF#Bank_switching
+class nsf_bus
+{
+  public:
+    // a few bytes of code used to call the nsf's routines live at these otherwise unmapped addresses
+    constexpr static std::uint16_t call_routine_address = 0x3FF0;
+    constexpr static std::uint16_t idle_address = call_routine_address + 3;
+
+    constexpr static std::size_t bank_size = 4096;
+
+    inline nsf_bus(apu& a, const nsf_file_header& header, std::vector<std::uint8_t>&& data)
+      : apu_{a},
+        wram_{},
+        sram_{},
+        uses_bankswitching_{header.uses_bankswitching()},
+        initial_banks_{},
+        banks_{},
+        rom_{},
+        call_routine_code_{}
+    {
+      // place the data so that each bank maps a whole 4KB of the address space
+      std::size_t padding = 0;
+
+      if(uses_bankswitching_)
+      {
+        padding = header.load_address & 0x0FFF;
+        std::copy(header.initial_banks, header.initial_banks + 8, initial_banks_.begin());
+      }
+      else
+      {
+        if(header.load_address < 0x8000)
+        {
+          throw std::runtime_error(fmt::format("nsf_bus: Unsupported load address: {:04X}", header.load_address));
+        }
+
+        padding = header.load_address - 0x8000;
+        for(std::size_t i = 0; i < initial_banks_.size(); ++i)
+        {
+          initial_banks_[i] = i;
+        }
+      }
+
+      std::size_t num_banks = (padding + data.size() + bank_size - 1) / bank_size;
+      rom_.resize(std::max<std::size_t>(num_banks, 1) * bank_size);
+      std::copy(data.begin(), data.end(), rom_.begin() + padding);
+
+      // JSR absolute followed by a JMP to itself
+      call_routine_code_ = {0x20, 0x00, 0x00, 0x4C, idle_address & 0xFF, idle_address >> 8};
+
+      reset();
+    }
+
+    // clears ram and restores the initial banks
+    inline void reset()
+    {
+      std::fill(wram_.begin(), wram_.end(), 0);
+      std::fill(sram_.begin(), sram_.end(), 0);
+
+      for(std::size_t i = 0; i < banks_.size(); ++i)
+      {
+        select_bank(i, initial_banks_[i]);
+      }
+    }
+
+    // the next time the cpu executes from call_routine_address, it calls the routine at address and then idles at idle_address
+    inline void set_routine(std::uint16_t address)
+    {
+      call_routine_code_[1] = address & 0xFF;
+      call_routine_code_[2] = address >> 8;
+    }
+
+    inline std::uint8_t read(std::uint16_t address)
+    {
+      std::uint8_t result = 0;
+
+      if(address < 0x2000)
+      {
+        // this bitwise and implements mirroring
+        result = wram_[address & 0x07FF];
+      }
+      else if(call_routine_address <= address and address < call_routine_address + call_routine_code_.size())
+      {
+        result = call_routine_code_[address - call_routine_address];
+      }
+      else if(address == 0x4015)
+      {
+        result = apu_.read_status_register();
+      }
+      else if(0x6000 <= address and address < 0x8000)
+      {
+        result = sram_[address - 0x6000];
+      }
+      else if(0x8000 <= address)
+      {
+        result = banks_[(address - 0x8000) / bank_size][address % bank_size];
+      }
+
+      // other addresses are an open bus, and return 0 as in cartridge::read
+
+      return result;
+    }
+
+    inline void write(std::uint16_t address, std::uint8_t value)
+    {
+      if(address < 0x2000)
+      {
+        // this bitwise and implements mirroring
+        wram_[address & 0x07FF] = value;
+      }
+      else if((0x4000 <= address and address < 0x4014) or address == 0x4015 or address == 0x4017)
+      {
+        apu_.write_register(address, value);
+      }
+      else if(0x5FF8 <= address and address < 0x6000)
+      {
+        if(uses_bankswitching_)
+        {
+          select_bank(address - 0x5FF8, value);
+        }
+      }
+      else if(0x6000 <= address and address < 0x8000)
+      {
+        sram_[address - 0x6000] = value;
+      }
+
+      // writes to other addresses are ignored
+    }
+
+  private:
+    inline void select_bank(std::size_t slot, std::uint8_t bank)
+    {
+      std::size_t num_banks = rom_.size() / bank_size;
+      banks_[slot] = rom_.data() + (bank % num_banks) * bank_size;
+    }
+
+    apu& apu_;
+    std::array<std::uint8_t,2048> wram_;
+    std::array<std::uint8_t,8192> sram_;
+
+    bool uses_bankswitching_;
+    std::array<std::uint8_t,8> initial_banks_;
+    std::array<const std::uint8_t*,8> banks_;
+    std::vector<std::uint8_t> rom_;
+
+    std::array<std::uint8_t,6> call_routine_code_;
+};
+
+
+// nsf_player renders the songs of an nsf file as fast as the host allows
+// see https://www.nesdev.org/wiki/NSF
+class nsf_player
+{
+  public:
+    inline nsf_player(const std::string& filename)
+      : nsf_player{std::ifstream{filename.c_str(), std::ios::binary}}
+    {}
+
+    inline nsf_player(std::istream&& is)
+      : nsf_player{nsf_file_header{is}, is}
+    {}
+
+    inline nsf_player(const nsf_file_header& header, std::istream& is)
+      : header_{header},
+        apu_{},
+        bus_{apu_, header, read_data(is)},
+        cpu_{bus_},
+        num_play_cycles_{},
+        play_clock_{0},
+        pending_samples_(band_limited_buffer::max_samples_per_frame),
+        num_pending_samples_{0},
+        next_pending_sample_{0}
+    {
+      if(header_.expansion_sound_flags != 0)
+      {
+        throw std::runtime_error(fmt::format("nsf_player: NSF requires unsupported expansion sound {:02X}", header_.expansion_sound_flags));
+      }
+
+      // only ntsc is emulated, so the ntsc play speed is used regardless of the nsf's region
+      // the speed is given in microseconds, and 0 means the default of about 60 Hz
+      double play_period_in_microseconds = header_.ntsc_play_speed ? header_.ntsc_play_speed : 16639;
+      num_play_cycles_ = play_period_in_microseconds * apu::cpu_clock_rate / 1e6;
+
+      start_song(starting_song());
+    }
+
+    nsf_player(const nsf_player&) = delete;
+
+    inline int num_songs() const
+    {
+      return header_.num_songs;
+    }
+
+    // songs are numbered from 0
+    inline int starting_song() const
+    {
+      return std::max(header_.starting_song, std::uint8_t{1}) - 1;
+    }
+
+    inline std::string song_name() const
+    {
+      return header_string(header_.song_name);
+    }
+
+    inline std::string artist() const
+    {
+      return header_string(header_.artist);
+    }
+
+    inline std::string copyright() const
+    {
+      return header_string(header_.copyright);
+    }
+
+    // the number of times per second which the play routine is called
+    inline double play_rate() const
+    {
+      return apu::cpu_clock_rate / num_play_cycles_;
+    }
+
+    inline nes::apu& apu()
+    {
+      return apu_;
+    }
+
+    // see https://www.nesdev.org/wiki/NSF#Initializing_a_tune
+    inline void start_song(int song)
+    {
+      if(song < 0 or song >= num_songs())
+      {
+        throw std::runtime_error(fmt::format("nsf_player::start_song: Bad song: {}", song));
+      }
+
+      bus_.reset();
+      cpu_.reset();
+
+      // silence the apu and put its frame counter in four-step mode
+      for(std::uint16_t address = 0x4000; address < 0x4014; ++address)
+      {
+        bus_.write(address, 0x00);
+      }
+      bus_.write(0x4015, 0x00);
+      bus_.write(0x4015, 0x0F);
+      bus_.write(0x4017, 0x40);
+
+      // discard whatever was playing
+      apu_.read_samples(pending_samples_);
+      num_pending_samples_ = 0;
+      next_pending_sample_ = 0;
+
+      // the init routine takes the song in the accumulator and the region in x, 0 for ntsc
+      call(header_.init_address, song, 0);
+
+      // the init routine must return, but allow it a generous amount of time before giving up
+      std::size_t limit = 10 * apu::cpu_clock_rate;
+      if(run(limit) == limit)
+      {
+        throw std::runtime_error(fmt::format("nsf_player::start_song: INIT routine for song {} did not return", song));
+      }
+
+      play_clock_ = 0;
+    }
+
+    // fills samples with the song's audio and returns the number of samples written, which is samples.size()
+    inline std::size_t render(std::span<float> samples)
+    {
+      std::size_t num_written = 0;
+
+      while(num_written < samples.size())
+      {
+        if(next_pending_sample_ == num_pending_samples_)
+        {
+          // read what the apu has synthesized, and play more only if there is none
+          num_pending_samples_ = apu_.read_samples(pending_samples_);
+          next_pending_sample_ = 0;
+
+          if(num_pending_samples_ == 0)
+          {
+            play();
+            continue;
+          }
+        }
+
+        std::size_t n = std::min(samples.size() - num_written, num_pending_samples_ - next_pending_sample_);
+        std::copy_n(pending_samples_.begin() + next_pending_sample_, n, samples.begin() + num_written);
+        next_pending_sample_ += n;
+        num_written += n;
+      }
+
+      return num_written;
+    }
+
+    // renders 16-bit samples, clamping the output of render(std::span<float>) to [-1, 1]
+    inline std::size_t render(std::span<std::int16_t> samples)
+    {
+      std::array<float,1024> block;
+
+      for(std::size_t i = 0; i < samples.size(); i += block.size())
+      {
+        std::size_t n = std::min(block.size(), samples.size() - i);
+        render(std::span(block).first(n));
+
+        std::transform(block.begin(), block.begin() + n, samples.begin() + i, [](float s)
+        {
+          return std::int16_t(std::clamp(s, -1.f, 1.f) * 32767.f);
+        });
+      }
+
+      return samples.size();
+    }
+
+  private:
+    inline static std::vector<std::uint8_t> read_data(std::istream& is)
+    {
+      return std::vector<std::uint8_t>{std::istreambuf_iterator<char>{is}, std::istreambuf_iterator<char>{}};
+    }
+
+    template<std::size_t N>
+    inline static std::string header_string(const char (&field)[N])
+    {
+      // the fields are null-terminated, unless they fill the whole field
+      return std::string{field, std::find(field, field + N, '\0')};
+    }
+
+    inline void call(std::uint16_t address, std::uint8_t a, std::uint8_t x)
+    {
+      bus_.set_routine(address);
+      cpu_.set_accumulator(a);
+      cpu_.set_index_register_x(x);
+      cpu_.set_program_counter(nsf_bus::call_routine_address);
+    }
+
+    // runs the cpu until it returns from the routine it is executing, or for at most max_num_cycles
+    // returns the number of cycles run
+    inline std::size_t run(std::size_t max_num_cycles)
+    {
+      std::size_t num_cycles = 0;
+
+      while(num_cycles < max_num_cycles and cpu_.program_counter() != nsf_bus::idle_address)
+      {
+        std::size_t n = cpu_.step_instruction();
+
+        for(std::size_t i = 0; i < n; ++i)
+        {
+          apu_.step_cycle();
+        }
+
+        num_cycles += n;
+      }
+
+      return num_cycles;
+    }
+
+    // runs the play routine for one play period
+    inline void play()
+    {
+      // the play routine is called at the beginning of each period
+      // if the previous call hasn't returned yet, the new call waits for the next period
+      if(cpu_.program_counter() == nsf_bus::idle_address)
+      {
+        call(header_.play_address, 0, 0);
+      }
+
+      // the length of each period alternates so that periods average to the fractional number of cycles
+      play_clock_ += num_play_cycles_;
+      std::size_t num_cycles = play_clock_;
+      play_clock_ -= num_cycles;
+
+      // once the routine returns, the cpu idles for the rest of the period, which only the apu notices
+      std::size_t num_cycles_run = run(num_cycles);
+      for(std::size_t i = num_cycles_run; i < num_cycles; ++i)
+      {
+        apu_.step_cycle();
+      }
+
+      // instructions may overrun the end of the period, so shorten the next one to keep time
+      play_clock_ -= double(num_cycles_run > num_cycles ? num_cycles_run - num_cycles : 0);
+    }
+
+    nsf_file_header header_;
+    nes::apu apu_;
+    nsf_bus bus_;
+    basic_cpu<nsf_bus> cpu_;
+
+    double num_play_cycles_;
+    double play_clock_;
+
+    std::vector<float> pending_samples_;
+    std::size_t num_pending_samples_;
+    std::size_t next_pending_sample_;
+};
+
+
+} // end nes
+
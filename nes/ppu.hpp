@@ -2,10 +2,12 @@
 
 #include "graphics_bus.hpp"
 #include "ppu_renderer.hpp"
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <cstdint>
 #include <optional>
+#include <span>
 
 
 namespace nes
@@ -24,15 +26,15 @@ class ppu
       : nmi{},
         bus_{gb},
         renderer_{bus_,framebuffer},
-        control_register_{},
-        mask_register_{},
-        status_register_{},
+        control_register_{renderer_.control_register()},
+        mask_register_{renderer_.mask_register()},
+        status_register_{renderer_.status_register()},
         oam_address_register_{},
         data_buffer_{},
         address_latch_{},
-        vram_address_{},
-        tram_address_{},
-        fine_x_{}
+        vram_address_{renderer_.vram_address()},
+        tram_address_{renderer_.tram_address()},
+        fine_x_{renderer_.fine_x()}
     {}
 
     inline std::uint8_t control_register() const
@@ -42,6 +44,8 @@ class ppu
 
     inline void set_control_register(std::uint8_t value)
     {
+      renderer_.invalidate_frame_if_rendering();
+
       control_register_.as_byte = value;
       tram_address_.nametable_x = control_register_.nametable_x;
       tram_address_.nametable_y = control_register_.nametable_y;
@@ -54,6 +58,8 @@ class ppu
 
     inline void set_mask_register(std::uint8_t value)
     {
+      renderer_.invalidate_frame_if_rendering();
+
       mask_register_.as_byte = value;
     }
 
@@ -92,10 +98,37 @@ class ppu
     {
       const std::uint8_t* c_ptr = reinterpret_cast<const std::uint8_t*>(object_attributes().data());
       std::uint8_t* ptr = const_cast<std::uint8_t*>(c_ptr);
-      ptr[oam_address_register_] = value;
+
+      if(ptr[oam_address_register_] != value)
+      {
+        renderer_.invalidate_frame();
+        ptr[oam_address_register_] = value;
+      }
+
       ++oam_address_register_;
     }
 
+    // copies a page of data into oam, beginning at the oam address register, as an oam dma does
+    inline void set_oam_data(std::span<const std::uint8_t,256> data)
+    {
+      const std::uint8_t* c_ptr = reinterpret_cast<const std::uint8_t*>(object_attributes().data());
+      std::uint8_t* ptr = const_cast<std::uint8_t*>(c_ptr);
+
+      // writes wrap around the end of oam
+      auto wrap_point = data.begin() + (256 - oam_address_register_);
+
+      // games usually transfer the same sprites frame after frame
+      if(not std::equal(data.begin(), wrap_point, ptr + oam_address_register_) or
+         not std::equal(wrap_point, data.end(), ptr))
+      {
+        renderer_.invalidate_frame();
+        std::copy(data.begin(), wrap_point, ptr + oam_address_register_);
+        std::copy(wrap_point, data.end(), ptr);
+      }
+
+      // after 256 writes, the oam address register has wrapped around to its original value
+    }
+
     inline std::uint8_t scroll_register() const
     {
       return 0;
@@ -103,6 +136,8 @@ class ppu
 
     inline void set_scroll_register(std::uint8_t value)
     {
+      renderer_.invalidate_frame_if_rendering();
+
       if(address_latch_)
       {
         tram_address_.fine_y = value & 0x07;
@@ -119,11 +154,14 @@ class ppu
 
     inline void set_address_register(std::uint8_t value)
     {
+      renderer_.invalidate_frame_if_rendering();
+
       if(address_latch_)
       {
         // write to low byte
         tram_address_.as_uint16 = (tram_address_.as_uint16 & 0xFF00) | value;
         vram_address_ = tram_address_;
+        watch_a12();
       }
       else
       {
@@ -136,6 +174,8 @@ class ppu
 
     inline std::uint8_t data_register()
     {
+      renderer_.invalidate_frame_if_rendering();
+
       std::uint8_t result = read(vram_address_.as_uint16);
 
       // reads are delayed by one read in this range
@@ -146,16 +186,20 @@ class ppu
 
       // increment address register
       vram_address_.as_uint16 += control_register_.vram_address_increment_mode ? 32 : 1;
+      watch_a12();
 
       return result;
     }
 
     inline void set_data_register(std::uint8_t value)
     {
+      renderer_.invalidate_frame_if_rendering();
+
       write(vram_address_.as_uint16, value);
 
       // increment address register
       vram_address_.as_uint16 += control_register_.vram_address_increment_mode ? 32 : 1;
+      watch_a12();
     }
 
     // XXX eliminate this function
@@ -166,18 +210,62 @@ class ppu
 
     inline void step_cycle()
     {
-      ppu_renderer::control_register_t control{};
-      control.as_byte = control_register_.as_byte;
+      advance(1);
+    }
 
-      bool entered_vertical_blank_period = renderer_.step_cycle(mask_register_.show_background, mask_register_.show_sprites,
-                                                                vram_address_, tram_address_,
-                                                                control_register_.background_pattern_table_address, fine_x_,
-                                                                control, status_register_, mask_register_);
+    // returns whether or not the ppu entered the vertical blank period
+    inline bool advance(std::size_t num_cycles)
+    {
+      bool entered_vertical_blank_period = renderer_.advance(num_cycles);
 
       if(entered_vertical_blank_period and control_register_.generate_nmi)
       {
         nmi = true;
       }
+
+      return entered_vertical_blank_period;
+    }
+
+    // this must be called before anything outside of the ppu which affects the rendered image changes,
+    // e.g. when the cartridge switches chr banks
+    inline void invalidate_frame()
+    {
+      renderer_.invalidate_frame();
+    }
+
+    // returns whether or not the most recent frame's image is identical to the frame before it
+    inline bool frame_unchanged() const
+    {
+      return renderer_.frame_unchanged();
+    }
+
+    constexpr static int tile_dim = ppu_renderer::tile_dim;
+    constexpr static int num_tile_rows = ppu_renderer::num_tile_rows;
+    using tile_row_mask = ppu_renderer::tile_row_mask;
+
+    // returns which tiles of the most recent frame's image differ from the frame before it
+    inline std::span<const tile_row_mask, num_tile_rows> changed_tiles() const
+    {
+      return renderer_.changed_tiles();
+    }
+
+    // returns which tiles of the pattern tables changed between the beginnings of the two most recent frames
+    inline const cartridge::pattern_tile_mask& changed_pattern_tiles() const
+    {
+      return renderer_.changed_pattern_tiles();
+    }
+
+    using layer_planes = ppu_renderer::layer_planes;
+
+    inline void enable_layer_planes(bool enable)
+    {
+      renderer_.enable_layer_planes(enable);
+    }
+
+    // returns nullptr when the layer planes are disabled
+    inline const layer_planes* planes() const
+    {
+      return renderer_.planes();
     }
 
     bool nmi;
@@ -226,49 +314,54 @@ class ppu
 
         renderer_.set_palette(address, value);
       }
+      else if(address < 0x2000)
+      {
+        // the cartridge marks the tiles which this changes as dirty,
+        // and the renderer checks those against the tiles the previous frame used before reusing it
+        bus_.write(address, value);
+      }
       else
       {
+        if(bus_.read(address) != value)
+        {
+          renderer_.invalidate_frame();
+        }
+
         bus_.write(address, value);
       }
     }
 
-    graphics_bus& bus_;
-    ppu_renderer renderer_;
-
-    union control_register_t
+    // the vram address only appears on the ppu's bus while the ppu isn't rendering
+    // while rendering, the bus carries the renderer's fetches, whose a12 reaches the mapper only through
+    // graphics_bus::a12_rose_while_rendering, and bit 12 of the vram address is just fine y's low bit
+    inline void watch_a12()
     {
-      std::uint8_t as_byte;
-      struct
+      if(not renderer_.rendering())
       {
-        bool nametable_x : 1;
-        bool nametable_y : 1;
-        bool vram_address_increment_mode : 1;
-        bool sprite_pattern_table_address : 1;
-        bool background_pattern_table_address : 1;
-        bool sprite_size : 1;
-        bool ppu_master_slave_select : 1;
-        bool generate_nmi : 1;
-      };
+        bus_.watch_a12(vram_address_.as_uint16);
+      }
+    }
 
-      control_register_t() : as_byte{} {}
-    };
+    graphics_bus& bus_;
+    ppu_renderer renderer_;
 
-    static_assert(sizeof(control_register_t) == sizeof(std::uint8_t));
+    using control_register_t = ppu_renderer::control_register_t;
 
     using mask_register_t = ppu_renderer::mask_register_t;
 
     using status_register_t = ppu_renderer::status_register_t;
 
     // register state
-    control_register_t control_register_;
-    mask_register_t mask_register_;
-    status_register_t status_register_;
+    // the renderer owns the registers it consults on every cycle
+    control_register_t& control_register_;
+    mask_register_t& mask_register_;
+    status_register_t& status_register_;
     std::uint8_t oam_address_register_;
     std::uint8_t data_buffer_;
     bool address_latch_;
-    ppu_renderer::loopy_register vram_address_;
-    ppu_renderer::loopy_register tram_address_;
-    std::uint8_t fine_x_;
+    ppu_renderer::loopy_register& vram_address_;
+    ppu_renderer::loopy_register& tram_address_;
+    std::uint8_t& fine_x_;
 };
 
 
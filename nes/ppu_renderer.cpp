@@ -1,4 +1,6 @@
 #include "ppu_renderer.hpp"
+#include <algorithm>
+#include <array>
 #include <cassert>
 
 
@@ -6,171 +8,469 @@ namespace nes
 {
 
 
+namespace
+{
+
+
+constexpr std::uint16_t num_cycles_per_scanline = 341;
+constexpr std::uint16_t num_scanlines_per_frame = 262;
+
+
+// each entry of the action table is a bitmask of the following actions
+// the low three bits select at most one background fetch to perform
+enum action : std::uint16_t
+{
+  no_fetch                     = 0,
+  fetch_tile_id                = 1,
+  fetch_tile_attribute         = 2,
+  fetch_tile_lsb               = 3,
+  fetch_tile_msb               = 4,
+  increment_x                  = 5,
+  fetch_superfluous_tile_id    = 6,
+  fetch_mask                   = 0b111,
+
+  shift_background             = 1 << 3,
+  increment_y                  = 1 << 4,
+  reload_background_and_copy_x = 1 << 5,
+  copy_y                       = 1 << 6,
+  evaluate_sprites             = 1 << 7,
+  read_sprites                 = 1 << 8,
+  output_pixel                 = 1 << 9,
+  set_vertical_blank           = 1 << 10,
+  clear_vertical_blank         = 1 << 11,
+  skip_cycle                   = 1 << 12
+};
+
+
 // see https://www.nesdev.org/wiki/PPU_rendering
 // and https://www.nesdev.org/wiki/File:Ntsc_timing.png
-bool ppu_renderer::step_cycle(bool show_background, bool show_sprites,
-                              loopy_register& vram_address, loopy_register tram_address,
-                              bool background_pattern_table_address, std::uint8_t fine_x,
-                              control_register_t control, status_register_t& status, mask_register_t mask)
+constexpr std::uint16_t actions_for_cycle(int scanline, int cycle)
 {
-  constexpr std::uint16_t num_cycles_per_scanline = 341;
-  constexpr std::uint16_t num_scanlines_per_frame = 262;
+  std::uint16_t result = 0;
 
   // if we're within the visible frame or within the prerender scanline
-  if(current_scanline_ < 240 or current_scanline_ == 261)
+  if(scanline < 240 or scanline == 261)
   {
-    if(current_scanline_ == 0 and current_scanline_cycle_ == 0)
+    if(scanline == 0 and cycle == 0)
     {
       // odd frame cycle skip
-      current_scanline_cycle_ = 1;
+      result |= skip_cycle;
     }
 
-    if((2 <= current_scanline_cycle_ and current_scanline_cycle_ < 258) or (321 <= current_scanline_cycle_ and current_scanline_cycle_ < 338))
+    if((2 <= cycle and cycle < 258) or (321 <= cycle and cycle < 338))
     {
-      maybe_update_background_pattern_shift_registers(show_background);
-      maybe_update_active_sprites(show_sprites and (current_scanline_cycle_ < 258));
+      result |= shift_background;
 
-      switch((current_scanline_cycle_ - 1) % 8)
+      switch((cycle - 1) % 8)
       {
-        case 0:
-        {
-          load_background_shift_registers();
-          read_next_background_tile_id(vram_address);
-          break;
-        }
+        case 0: result |= fetch_tile_id; break;
+        case 2: result |= fetch_tile_attribute; break;
+        case 4: result |= fetch_tile_lsb; break;
+        case 6: result |= fetch_tile_msb; break;
+        case 7: result |= increment_x; break;
+      }
+    }
 
-        case 2:
-        {
-          read_next_background_tile_attribute(vram_address);
-          break;
-        }
+    if(cycle == 256)
+    {
+      result |= increment_y;
+    }
 
-        case 4:
-        {
-          read_next_background_tile_lsb(vram_address, background_pattern_table_address);
-          break;
-        }
+    if(cycle == 257)
+    {
+      result |= reload_background_and_copy_x;
+    }
 
-        case 6:
-        {
-          read_next_background_tile_msb(vram_address, background_pattern_table_address);
-          break;
-        }
+    if(cycle == 338 or cycle == 340)
+    {
+      // this is a superfluous read at the end of a scanline
+      result |= fetch_superfluous_tile_id;
+    }
 
-        case 7:
-        {
-          maybe_increment_x(show_background or show_sprites, vram_address);
-          break;
-        }
-      }
+    if(scanline == 261 and 280 <= cycle and cycle < 305)
+    {
+      result |= copy_y;
     }
+  }
+
+  // evaluate sprites at the end of the scanline
+  if(cycle == 257 and (scanline < 239 or scanline == 261))
+  {
+    result |= evaluate_sprites;
+  }
+
+  // on the last cycle of a scanline, read the next scanline's sprite data
+  if(cycle == 340 and (scanline < 239 or scanline == 261))
+  {
+    result |= read_sprites;
+  }
+
+  // the PPU idles on cycle 0, so pixels are output on cycles [1, 256]
+  if(scanline < ppu_renderer::framebuffer_height and 0 < cycle and cycle <= ppu_renderer::framebuffer_width)
+  {
+    result |= output_pixel;
+  }
+
+  if(cycle == 1 and scanline == 241)
+  {
+    result |= set_vertical_blank;
+  }
+
+  if(cycle == 1 and scanline == 261)
+  {
+    result |= clear_vertical_blank;
+  }
+
+  return result;
+}
+
+
+constexpr std::array<std::uint16_t, num_scanlines_per_frame * num_cycles_per_scanline> make_action_table()
+{
+  // there are only a handful of distinct kinds of scanlines, so compute each
+  // kind once and copy it into place to keep constant evaluation cheap
+  constexpr std::array<int,6> representatives = {0, 1, 239, 240, 241, 261};
+
+  std::array<std::array<std::uint16_t, num_cycles_per_scanline>, representatives.size()> rows{};
+  for(std::size_t i = 0; i < representatives.size(); ++i)
+  {
+    for(int cycle = 0; cycle < num_cycles_per_scanline; ++cycle)
+    {
+      rows[i][cycle] = actions_for_cycle(representatives[i], cycle);
+    }
+  }
+
+  std::array<std::uint16_t, num_scanlines_per_frame * num_cycles_per_scanline> result{};
+  for(int scanline = 0; scanline < num_scanlines_per_frame; ++scanline)
+  {
+    std::size_t kind =
+      scanline == 0   ? 0 :
+      scanline <  239 ? 1 :
+      scanline == 239 ? 2 :
+      scanline == 241 ? 4 :
+      scanline == 261 ? 5 :
+      3
+    ;
 
-    if(current_scanline_cycle_ == 256)
+    for(int cycle = 0; cycle < num_cycles_per_scanline; ++cycle)
     {
-      maybe_increment_y(show_background or show_sprites, vram_address);
+      result[scanline * num_cycles_per_scanline + cycle] = rows[kind][cycle];
     }
+  }
+
+  return result;
+}
+
+
+constexpr std::array<std::uint16_t, num_scanlines_per_frame * num_cycles_per_scanline> action_table = make_action_table();
+
+
+} // end anonymous namespace
+
+
+bool ppu_renderer::step_cycle()
+{
+  std::uint16_t actions = action_table[current_scanline_ * num_cycles_per_scanline + current_scanline_cycle_];
+
+  if(actions & skip_cycle)
+  {
+    current_scanline_cycle_ = 1;
+    actions = action_table[current_scanline_ * num_cycles_per_scanline + current_scanline_cycle_];
+  }
+
+  bool show_background = mask_register_.show_background;
+  bool show_sprites = mask_register_.show_sprites;
+  bool rendering_enabled = show_background or show_sprites;
 
-    if(current_scanline_cycle_ == 257)
+  if(actions & shift_background)
+  {
+    maybe_update_background_pattern_shift_registers(show_background);
+  }
+
+  switch(actions & fetch_mask)
+  {
+    case fetch_tile_id:
     {
       load_background_shift_registers();
-      maybe_copy_x(show_background or show_sprites, vram_address, tram_address);
+      read_next_background_tile_id();
+      break;
     }
 
-    if(current_scanline_cycle_ == 338 or current_scanline_cycle_ == 340)
+    case fetch_tile_attribute:
     {
-      // this is a superfluous read at the end of a scanline
-      read_next_background_tile_id(vram_address);
+      read_next_background_tile_attribute();
+      break;
+    }
+
+    case fetch_tile_lsb:
+    {
+      read_next_background_tile_lsb();
+      break;
     }
 
-    if(current_scanline_ == 261 and 280 <= current_scanline_cycle_ and current_scanline_cycle_ < 305)
+    case fetch_tile_msb:
     {
-      maybe_copy_y(show_background or show_sprites, vram_address, tram_address);
+      read_next_background_tile_msb();
+      break;
+    }
+
+    case increment_x:
+    {
+      maybe_increment_x(rendering_enabled);
+      break;
+    }
+
+    case fetch_superfluous_tile_id:
+    {
+      read_next_background_tile_id();
+      break;
     }
   }
 
-  // evaluate sprites at the end of the scanline
-  if(current_scanline_cycle_ == 257 and (current_scanline_ < 239 or current_scanline_ == 261))
+  if(actions & increment_y)
   {
-    evaluate_sprites_for_next_scanline(control.sprite_size, status);
+    maybe_increment_y(rendering_enabled);
   }
 
-  // on the last cycle of a scanline, read the next scanline's sprite data
-  if(current_scanline_cycle_ == 340 and (current_scanline_ < 239 or current_scanline_ == 261))
+  if(actions & reload_background_and_copy_x)
   {
-    read_sprites_for_next_scanline(control);
+    load_background_shift_registers();
+    maybe_copy_x(rendering_enabled);
   }
 
-  // render the foreground color
-  auto [sprite_idx, prioritize_foreground, foreground] = maybe_render_foreground(show_sprites);
+  if(actions & copy_y)
+  {
+    maybe_copy_y(rendering_enabled);
+  }
 
-  // render the background color
-  auto background = maybe_render_background(show_background, fine_x);
+  if(actions & evaluate_sprites)
+  {
+    evaluate_sprites_for_next_scanline();
+  }
 
-  // composite foreground and background
-  auto [palette_idx, color_idx] = composite(prioritize_foreground, foreground, background);
+  if(actions & read_sprites)
+  {
+    read_sprites_for_next_scanline();
+  }
 
-  // determine whether sprite zero was "hit"
-  if(active_sprites_[0].first == 0 and sprite_idx == 0)
+  if(actions & output_pixel)
   {
-    // the scanline intersected sprite zero
+    // render the foreground color
+    sprite_pixel sprite = maybe_render_foreground(show_sprites);
+    std::uint8_t foreground_palette_idx = sprite.palette_idx;
+    std::uint8_t foreground_color_idx = sprite.color_idx;
+    std::pair foreground{foreground_palette_idx, foreground_color_idx};
+
+    // render the background color
+    auto background = maybe_render_background(show_background);
 
-    if(background.second != 0 and foreground.second != 0)
+    // composite foreground and background
+    auto [palette_idx, color_idx] = composite(sprite.prioritize_foreground, foreground, background);
+
+    // determine whether sprite zero was "hit"
+    if(sprite.is_sprite_zero)
     {
-      // both background and foreground were non-transparent
+      // the scanline intersected sprite zero
 
-      if(show_background and show_sprites)
+      if(background.second != 0 and foreground.second != 0)
       {
-        // both background and sprites were enabled
+        // both background and foreground were non-transparent
 
-        // The left edge of the screen has specific switches to control
-        // its appearance. This is used to smooth inconsistencies when
-        // scrolling (since sprites x coord must be >= 0)
-        if(not (mask.show_background_in_leftmost_8_pixels_of_screen or mask.show_sprites_in_leftmost_8_pixels_of_screen))
+        if(show_background and show_sprites)
         {
-          if(9 <= current_scanline_cycle_ and current_scanline_cycle_ < 258)
+          // both background and sprites were enabled
+
+          // The left edge of the screen has specific switches to control
+          // its appearance. This is used to smooth inconsistencies when
+          // scrolling (since sprites x coord must be >= 0)
+          if(not (mask_register_.show_background_in_leftmost_8_pixels_of_screen or mask_register_.show_sprites_in_leftmost_8_pixels_of_screen))
           {
-            status.sprite_zero_hit = 1;
+            if(9 <= current_scanline_cycle_)
+            {
+              hit_sprite_zero();
+            }
           }
-        }
-        else
-        {
-          if(1 <= current_scanline_cycle_ and current_scanline_cycle_ < 258)
+          else
           {
-            status.sprite_zero_hit = 1;
+            hit_sprite_zero();
           }
         }
       }
     }
+
+    // write to the framebuffer
+    // the PPU idles on cycle 0, so we subtract 1 from current_scanline_cycle_ to find the pixel's x coordinate
+    write_pixel(current_scanline_cycle_ - 1, current_scanline_, as_rgb(palette_idx, color_idx));
+
+    if(layer_planes_)
+    {
+      write_layers(current_scanline_cycle_ - 1, current_scanline_, sprite, background);
+    }
   }
-  
-  // maybe write to the framebuffer
-  // the PPU idles on row 0, so we subtract 1 from current_scanline_cycle_ to find the pixel's x coordintae
-  if(0 <= current_scanline_       and current_scanline_       <  framebuffer_height and
-     0 <  current_scanline_cycle_ and current_scanline_cycle_ <= framebuffer_width)
+
+  // decide the result and whether to update the status register
+  bool entered_vertical_blank_period = false;
+  if(actions & set_vertical_blank)
   {
-    std::uint16_t pixel_idx = current_scanline_ * framebuffer_width + current_scanline_cycle_ - 1;
-    framebuffer_[pixel_idx] = as_rgb(palette_idx, color_idx);
+    status_register_.in_vertical_blank_period = true;
+    entered_vertical_blank_period = true;
+  }
+  else if(actions & clear_vertical_blank)
+  {
+    status_register_.sprite_overflow = false;
+    status_register_.sprite_zero_hit = false;
+    status_register_.in_vertical_blank_period = false;
+  }
+
+  // update the current scanline state
+  current_scanline_cycle_++;
+  if(current_scanline_cycle_ == num_cycles_per_scanline)
+  {
+    current_scanline_cycle_ = 0;
+
+    current_scanline_++;
+    if(current_scanline_ == num_scanlines_per_frame)
+    {
+      current_scanline_ = 0;
+    }
+  }
+
+  return entered_vertical_blank_period;
+}
+
+
+bool ppu_renderer::advance(std::size_t num_cycles)
+{
+  bool entered_vertical_blank_period = false;
+
+  while(num_cycles > 0)
+  {
+    if(current_scanline_ == 261 and current_scanline_cycle_ == 0)
+    {
+      begin_frame();
+    }
+    else if(current_scanline_ == 240 and current_scanline_cycle_ == 0)
+    {
+      end_frame();
+    }
+
+    // mappers which count scanlines see a12 rise at a point predicted from the registers at the beginning of each step
+    int rise_cycle = bus_.watching_a12() ? a12_rise_cycle() : -1;
+    int begin = current_scanline_cycle_;
+
+    if(is_idle())
+    {
+      auto [num_skipped, entered] = skip_idle_cycles(num_cycles);
+      entered_vertical_blank_period |= entered;
+      num_cycles -= num_skipped;
+    }
+    else
+    {
+      entered_vertical_blank_period |= step_cycle();
+      --num_cycles;
+    }
+
+    // steps end within the scanline in which they began
+    int end = current_scanline_cycle_ == 0 ? num_cycles_per_scanline : current_scanline_cycle_;
+    if(begin <= rise_cycle and rise_cycle < end)
+    {
+      bus_.a12_rose_while_rendering();
+    }
+  }
+
+  return entered_vertical_blank_period;
+}
+
+
+std::pair<std::size_t,bool> ppu_renderer::skip_idle_cycles(std::size_t num_cycles)
+{
+  assert(is_idle());
+
+  if(current_scanline_ == 0 and current_scanline_cycle_ == 0)
+  {
+    // odd frame cycle skip
+    current_scanline_cycle_ = 1;
+  }
+
+  // skip to the end of the current scanline at most
+  std::uint16_t begin = current_scanline_cycle_;
+  std::uint16_t end = std::min<std::size_t>(num_cycles_per_scanline, begin + num_cycles);
+
+  auto within = [=](std::uint16_t cycle)
+  {
+    return begin <= cycle and cycle < end;
+  };
+
+  if(current_scanline_ < framebuffer_height and not reusing_frame_)
+  {
+    // with rendering disabled, the ppu outputs the backdrop color
+    // the PPU idles on cycle 0, so we subtract 1 from the cycle to find the pixel's x coordinate
+    std::uint16_t first_x = std::max<std::uint16_t>(begin, 1) - 1;
+    std::uint16_t last_x  = std::min<std::uint16_t>(end, framebuffer_width + 1) - 1;
+
+    rgb backdrop = as_rgb(0,0);
+    for(std::uint16_t x = first_x; x < last_x; ++x)
+    {
+      write_pixel(x, current_scanline_, backdrop);
+    }
+
+    if(layer_planes_ and first_x < last_x)
+    {
+      write_backdrop_layers(first_x, last_x, current_scanline_);
+    }
+  }
+
+  if(current_scanline_ < 239 or current_scanline_ == 261)
+  {
+    // no sprites are found for the next scanline while rendering is disabled
+    if(within(257))
+    {
+      active_sprites_.clear();
+    }
+
+    if(within(340))
+    {
+      sprite_line_buffer_.fill({});
+    }
+  }
+
+  if(reusing_frame_)
+  {
+    // the status flags are set on the same cycles as they were in the previous frame
+    auto within_frame = [&](std::optional<int> frame_cycle)
+    {
+      return frame_cycle and *frame_cycle / num_cycles_per_scanline == current_scanline_ and within(*frame_cycle % num_cycles_per_scanline);
+    };
+
+    if(within_frame(sprite_zero_hit_cycle_))
+    {
+      status_register_.sprite_zero_hit = true;
+    }
+
+    if(within_frame(sprite_overflow_cycle_))
+    {
+      status_register_.sprite_overflow = true;
+    }
   }
 
-  // decide the result and whether to update the status register
   bool entered_vertical_blank_period = false;
-  if(current_scanline_cycle_ == 1)
+  if(within(1))
   {
     if(current_scanline_ == 241)
     {
-      status.in_vertical_blank_period = true;
+      status_register_.in_vertical_blank_period = true;
       entered_vertical_blank_period = true;
     }
     else if(current_scanline_ == 261)
     {
-      status.sprite_overflow = false;
-      status.sprite_zero_hit = false;
-      status.in_vertical_blank_period = false;
+      status_register_.sprite_overflow = false;
+      status_register_.sprite_zero_hit = false;
+      status_register_.in_vertical_blank_period = false;
     }
   }
-  
+
   // update the current scanline state
-  current_scanline_cycle_++;
+  current_scanline_cycle_ = end;
   if(current_scanline_cycle_ == num_cycles_per_scanline)
   {
     current_scanline_cycle_ = 0;
@@ -182,9 +482,111 @@ bool ppu_renderer::step_cycle(bool show_background, bool show_sprites,
     }
   }
 
-  return entered_vertical_blank_period;
+  return {end - begin, entered_vertical_blank_period};
 }
 
 
-} // end nes
+void ppu_renderer::begin_frame()
+{
+  bool rendering_enabled = mask_register_.show_background or mask_register_.show_sprites;
+
+  // with rendering disabled, only the backdrop color in the palette matters
+  frame_inputs inputs{};
+  inputs.mask = mask_register_.as_byte;
+  if(rendering_enabled)
+  {
+    inputs.control = control_register_.as_byte;
+    inputs.tram_address = tram_address_.as_uint16;
+    inputs.fine_x = fine_x_;
+  }
+
+  // publish the pattern tiles changed since the previous frame began
+  changed_pattern_tiles_ = bus_.dirty_tiles();
+  bus_.clear_dirty_tiles();
+
+  bool fetched_tile_changed = false;
+  for(std::size_t i = 0; i < fetched_pattern_tiles_.size(); ++i)
+  {
+    fetched_tile_changed |= (fetched_pattern_tiles_[i] & changed_pattern_tiles_[i]) != 0;
+  }
+
+  // the previous frame can be reused if nothing it depends on has changed since it began
+  reusing_frame_ = not frame_dirty_ and not fetched_tile_changed and inputs == previous_frame_inputs_;
+  frame_unchanged_ = reusing_frame_;
+
+  previous_frame_inputs_ = inputs;
+  frame_dirty_ = false;
+
+  if(not reusing_frame_)
+  {
+    // these get recorded as the frame is rendered
+    sprite_zero_hit_cycle_.reset();
+    sprite_overflow_cycle_.reset();
+    fetched_pattern_tiles_.fill(0);
+  }
+}
+
+
+void ppu_renderer::end_frame()
+{
+  // publish the tiles changed by this frame
+  changed_tiles_in_frame_ = changed_tiles_;
+  changed_tiles_.fill(0);
 
+  if(reusing_frame_)
+  {
+    // leave the vram address as rendering the frame would have
+    vram_address_ = vram_address_after_frame_;
+    reusing_frame_ = false;
+  }
+  else
+  {
+    vram_address_after_frame_ = vram_address_;
+  }
+}
+
+
+void ppu_renderer::invalidate_frame()
+{
+  frame_dirty_ = true;
+
+  if(reusing_frame_)
+  {
+    reusing_frame_ = false;
+    frame_unchanged_ = false;
+
+    // nothing has changed since the frame began, so catch up by rendering
+    // the frame from its beginning until the current cycle
+    std::uint16_t scanline = current_scanline_;
+    std::uint16_t cycle = current_scanline_cycle_;
+
+    current_scanline_ = 261;
+    current_scanline_cycle_ = 0;
+
+    while(current_scanline_ != scanline or current_scanline_cycle_ != cycle)
+    {
+      if(is_idle())
+      {
+        if(current_scanline_ == 0 and current_scanline_cycle_ == 0)
+        {
+          // odd frame cycle skip
+          current_scanline_cycle_ = 1;
+        }
+
+        std::size_t num_cycles = (current_scanline_ == scanline and current_scanline_cycle_ < cycle) ?
+          cycle - current_scanline_cycle_ :
+          num_cycles_per_scanline - current_scanline_cycle_
+        ;
+
+        skip_idle_cycles(num_cycles);
+      }
+      else
+      {
+        step_cycle();
+      }
+    }
+  }
+}
+
+
+} // end nes
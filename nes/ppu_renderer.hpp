@@ -5,6 +5,8 @@
 #include <array>
 #include <cassert>
 #include <cstdint>
+#include <memory>
+#include <optional>
 #include <span>
 
 
@@ -19,11 +21,19 @@ class ppu_renderer
     struct rgb
     {
       std::uint8_t r,g,b;
+
+      bool operator==(const rgb&) const = default;
     };
 
     constexpr static int framebuffer_width  = 256;
     constexpr static int framebuffer_height = 240;
 
+    // the framebuffer is divided into 32 * 30 tiles of 8 * 8 pixels
+    // each row of tiles is described by a 32-bit mask with one bit per tile column
+    constexpr static int tile_dim = 8;
+    constexpr static int num_tile_rows = framebuffer_height / tile_dim;
+    using tile_row_mask = std::uint32_t;
+
     ppu_renderer(graphics_bus& bus, std::span<rgb, framebuffer_width*framebuffer_height> framebuffer)
       : bus_{bus},
         palette_{},
@@ -40,8 +50,25 @@ class ppu_renderer
         background_attribute_shift_register_low_{},
         background_attribute_shift_register_high_{},
         active_sprites_{},
-        sprite_pattern_shift_register_low_{{}},
-        sprite_pattern_shift_register_high_{{}}
+        sprite_line_buffer_{{}},
+        control_register_{},
+        mask_register_{},
+        status_register_{},
+        vram_address_{},
+        tram_address_{},
+        fine_x_{},
+        previous_frame_inputs_{},
+        frame_dirty_{true},
+        reusing_frame_{false},
+        frame_unchanged_{false},
+        sprite_zero_hit_cycle_{},
+        sprite_overflow_cycle_{},
+        vram_address_after_frame_{},
+        changed_tiles_{},
+        changed_tiles_in_frame_{},
+        fetched_pattern_tiles_{},
+        changed_pattern_tiles_{},
+        layer_planes_{}
     {}
 
     inline std::uint8_t palette(std::uint8_t i) const
@@ -51,7 +78,11 @@ class ppu_renderer
 
     inline void set_palette(std::uint8_t i, std::uint8_t value)
     {
-      palette_[i] = value;
+      if(palette_[i] != value)
+      {
+        invalidate_frame();
+        palette_[i] = value;
+      }
     }
 
     inline rgb as_rgb(int palette_idx, std::uint8_t color_idx) const
@@ -133,12 +164,140 @@ class ppu_renderer
 
     static_assert(sizeof(mask_register_t) == sizeof(std::uint8_t));
 
-    // executes the next ppu cycle and returns whether or not the ppu has entered the vertical blank period
-    // XXX it might be more convenient to just pass this a copy of the control register and a reference to the status register
-    bool step_cycle(bool show_background, bool show_sprites,
-                    loopy_register& vram_address, loopy_register tram_address,
-                    bool background_pattern_table_address, std::uint8_t fine_x,
-                    control_register_t control, status_register_t& status, mask_register_t mask);
+    // a single pixel of a scanline's worth of rasterized sprites
+    struct sprite_pixel
+    {
+      std::uint8_t color_idx : 2;
+      std::uint8_t palette_idx : 3;
+      bool prioritize_foreground : 1;
+      bool is_sprite_zero : 1;
+    };
+
+    static_assert(sizeof(sprite_pixel) == sizeof(std::uint8_t));
+
+    // the renderer owns the registers it consults on every cycle
+    // the ppu reads and writes them in response to the cpu
+    inline control_register_t& control_register()
+    {
+      return control_register_;
+    }
+
+    inline mask_register_t& mask_register()
+    {
+      return mask_register_;
+    }
+
+    inline status_register_t& status_register()
+    {
+      return status_register_;
+    }
+
+    inline loopy_register& vram_address()
+    {
+      return vram_address_;
+    }
+
+    inline loopy_register& tram_address()
+    {
+      return tram_address_;
+    }
+
+    inline std::uint8_t& fine_x()
+    {
+      return fine_x_;
+    }
+
+    // executes the next num_cycles ppu cycles and returns whether or not the ppu has entered the vertical blank period
+    // periods during which the ppu does no rendering work are skipped over in bulk
+    bool advance(std::size_t num_cycles);
+
+    // when nothing which affects the image changes between frames, the renderer
+    // reuses the previous frame's image rather than rendering it again
+
+    // the ppu calls this before it changes any state which affects the rendered image
+    void invalidate_frame();
+
+    // the ppu calls this before it changes a register which affects rendering
+    inline void invalidate_frame_if_rendering()
+    {
+      // register writes between frames are accounted for when the next frame begins
+      if(current_scanline_ < 240 or current_scanline_ == 261)
+      {
+        invalidate_frame();
+      }
+    }
+
+    // returns whether or not the ppu is fetching for rendering, i.e. rendering is enabled and the current scanline
+    // is visible or the pre-render scanline. a frame whose image is being reused counts, as the ppu would be fetching
+    inline bool rendering() const
+    {
+      bool rendering_enabled = mask_register_.show_background or mask_register_.show_sprites;
+      return rendering_enabled and (current_scanline_ < 240 or current_scanline_ == 261);
+    }
+
+    // returns whether or not the most recent frame's image is identical to the frame before it
+    inline bool frame_unchanged() const
+    {
+      return frame_unchanged_;
+    }
+
+    // returns which tiles of the most recent frame's image differ from the frame before it
+    inline std::span<const tile_row_mask, num_tile_rows> changed_tiles() const
+    {
+      return changed_tiles_in_frame_;
+    }
+
+    // returns which tiles of the pattern tables changed between the beginnings of the two most recent frames
+    inline const cartridge::pattern_tile_mask& changed_pattern_tiles() const
+    {
+      return changed_pattern_tiles_;
+    }
+
+    // per-pixel planes which describe how each pixel of the framebuffer was composited
+    struct layer_planes
+    {
+      // the index into palette memory of each pixel's background and sprite colors
+      // or 0 where that layer is transparent
+      std::array<std::uint8_t, framebuffer_width*framebuffer_height> background;
+      std::array<std::uint8_t, framebuffer_width*framebuffer_height> sprites;
+
+      // which layer each pixel came from, combined with the flags below
+      std::array<std::uint8_t, framebuffer_width*framebuffer_height> sources;
+    };
+
+    constexpr static std::uint8_t backdrop_source   = 0;
+    constexpr static std::uint8_t background_source = 1;
+    constexpr static std::uint8_t sprite_source     = 2;
+    constexpr static std::uint8_t source_bitmask    = 0b0011;
+
+    // set when a pixel has an opaque sprite color which has lower priority than the background
+    constexpr static std::uint8_t sprite_behind_background_bitmask = 0b0100;
+
+    // set when a pixel has an opaque color from sprite zero
+    constexpr static std::uint8_t sprite_zero_bitmask = 0b1000;
+
+    // the planes are produced alongside the framebuffer while enabled and are complete from the next frame on
+    // while disabled, they are not allocated and cost nothing to produce
+    inline void enable_layer_planes(bool enable)
+    {
+      if(enable and not layer_planes_)
+      {
+        layer_planes_ = std::make_unique<layer_planes>();
+
+        // a reused frame has no planes to reuse
+        invalidate_frame();
+      }
+      else if(not enable)
+      {
+        layer_planes_.reset();
+      }
+    }
+
+    // returns nullptr when the planes are disabled
+    inline const layer_planes* planes() const
+    {
+      return layer_planes_.get();
+    }
 
     struct object_attribute
     {
@@ -223,27 +382,194 @@ class ppu_renderer
 
     // this is an array of (idx into object_attributes_, x_position)
     bounded_array<std::pair<std::uint8_t,std::uint8_t>,8> active_sprites_;
-    std::array<std::uint8_t,8> sprite_pattern_shift_register_low_;
-    std::array<std::uint8_t,8> sprite_pattern_shift_register_high_;
+
+    // the active sprites are rasterized into this buffer once per scanline
+    // each pixel holds the highest priority non-transparent sprite pixel at that x coordinate
+    std::array<sprite_pixel, framebuffer_width> sprite_line_buffer_;
+
+    // register state
+    control_register_t control_register_;
+    mask_register_t mask_register_;
+    status_register_t status_register_;
+    loopy_register vram_address_;
+    loopy_register tram_address_;
+    std::uint8_t fine_x_;
+
+    // the state which determines the rendered image, besides memory
+    struct frame_inputs
+    {
+      std::uint8_t control;
+      std::uint8_t mask;
+      std::uint16_t tram_address;
+      std::uint8_t fine_x;
+
+      bool operator==(const frame_inputs&) const = default;
+    };
+
+    // frame memoization state
+    frame_inputs previous_frame_inputs_;
+    bool frame_dirty_;
+    bool reusing_frame_;
+    bool frame_unchanged_;
+    std::optional<int> sprite_zero_hit_cycle_;
+    std::optional<int> sprite_overflow_cycle_;
+    loopy_register vram_address_after_frame_;
+
+    // tiles changed so far during the current frame, and during the most recent complete frame
+    std::array<tile_row_mask, num_tile_rows> changed_tiles_;
+    std::array<tile_row_mask, num_tile_rows> changed_tiles_in_frame_;
+
+    // the pattern tiles which the most recently rendered frame fetched, and those which changed before the current frame
+    // a change to chr which the previous frame didn't fetch doesn't prevent reusing it
+    cartridge::pattern_tile_mask fetched_pattern_tiles_;
+    cartridge::pattern_tile_mask changed_pattern_tiles_;
+
+    inline void note_fetched_pattern_tile(std::uint16_t address)
+    {
+      int tile = address >> 4;
+      fetched_pattern_tiles_[tile / 64] |= std::uint64_t{1} << (tile % 64);
+    }
+
+    std::unique_ptr<layer_planes> layer_planes_;
+
+    // writes a pixel of each layer plane
+    inline void write_layers(int x, int y, sprite_pixel sprite, std::pair<std::uint8_t,std::uint8_t> background)
+    {
+      std::size_t i = y * framebuffer_width + x;
+
+      bool opaque_background = background.second != 0;
+      bool opaque_sprite = sprite.color_idx != 0;
+
+      layer_planes_->background[i] = opaque_background ? 4*background.first + background.second : 0;
+      layer_planes_->sprites[i] = opaque_sprite ? 4*sprite.palette_idx + sprite.color_idx : 0;
+
+      // this matches the decision made by composite
+      std::uint8_t source = backdrop_source;
+      if(opaque_sprite and (not opaque_background or sprite.prioritize_foreground))
+      {
+        source = sprite_source;
+      }
+      else if(opaque_background)
+      {
+        source = background_source;
+      }
+
+      if(opaque_sprite and not sprite.prioritize_foreground)
+      {
+        source |= sprite_behind_background_bitmask;
+      }
+
+      if(opaque_sprite and sprite.is_sprite_zero)
+      {
+        source |= sprite_zero_bitmask;
+      }
+
+      layer_planes_->sources[i] = source;
+    }
+
+    // writes a span of a scanline of each layer plane with the backdrop
+    inline void write_backdrop_layers(int first_x, int last_x, int y)
+    {
+      auto clear = [&](auto& plane)
+      {
+        std::fill(plane.begin() + y * framebuffer_width + first_x, plane.begin() + y * framebuffer_width + last_x, 0);
+      };
+
+      clear(layer_planes_->background);
+      clear(layer_planes_->sprites);
+      clear(layer_planes_->sources);
+    }
+
+    // writes a pixel of the framebuffer and notes its tile as changed if its color differs
+    inline void write_pixel(int x, int y, rgb color)
+    {
+      rgb& pixel = framebuffer_[y * framebuffer_width + x];
+
+      // most pixels of a scrolling image change, so avoid branching on the comparison
+      tile_row_mask changed = (pixel.r ^ color.r) | (pixel.g ^ color.g) | (pixel.b ^ color.b);
+      pixel = color;
+      changed_tiles_[y / tile_dim] |= tile_row_mask{changed != 0} << (x / tile_dim);
+    }
+
+    // executes the next ppu cycle and returns whether or not the ppu has entered the vertical blank period
+    bool step_cycle();
+
+    // these are called by advance at the boundaries of the rendered portion of a frame
+    void begin_frame();
+    void end_frame();
+
+    inline void hit_sprite_zero()
+    {
+      if(not status_register_.sprite_zero_hit)
+      {
+        sprite_zero_hit_cycle_ = frame_cycle();
+      }
+
+      status_register_.sprite_zero_hit = true;
+    }
+
+    // returns the index of the current cycle within a frame
+    inline int frame_cycle() const
+    {
+      return current_scanline_ * 341 + current_scanline_cycle_;
+    }
 
     // the following functions are called by step_cycle and mutate the state above
 
-    inline void read_next_background_tile_id(loopy_register vram_address)
+    // returns whether the current cycle begins a period in which the ppu does no rendering work
+    inline bool is_idle() const
+    {
+      bool rendering_enabled = mask_register_.show_background or mask_register_.show_sprites;
+
+      // the post-render scanline and the vertical blank scanlines are always idle
+      // and so is a frame whose image is being reused
+      return reusing_frame_ or not rendering_enabled or (240 <= current_scanline_ and current_scanline_ < 261);
+    }
+
+    // returns the cycle of the current scanline on which a12 rises past the mmc3's filter, or -1 if it doesn't rise
+    // this doesn't depend on the order of the renderer's fetches, nor whether or not they happen at all
+    // see https://www.nesdev.org/wiki/MMC3#IRQ_Specifics
+    inline int a12_rise_cycle() const
     {
-      // only take the low 14 bits of vram_address
+      if(not rendering()) return -1;
+
+      bool background_high = control_register_.background_pattern_table_address;
+
+      // 8x16 sprites choose their pattern table by tile, but unused sprite slots fetch from 0x1000
+      bool sprites_high = control_register_.sprite_pattern_table_address or control_register_.sprite_size;
+
+      // with the first sprite fetch
+      if(sprites_high and not background_high) return 260;
+
+      // with the first background fetch for the next scanline
+      if(background_high and not sprites_high) return 324;
+
+      // otherwise a12 stays high or low except briefly, and at most rises with the first fetch after the vertical blank period
+      if(background_high and current_scanline_ == 261) return 5;
+
+      return -1;
+    }
+
+    // skips over at most num_cycles idle cycles, stopping at the end of the current scanline
+    // returns (the number of cycles skipped, whether or not the ppu has entered the vertical blank period)
+    std::pair<std::size_t,bool> skip_idle_cycles(std::size_t num_cycles);
+
+    inline void read_next_background_tile_id()
+    {
+      // only take the low 14 bits of vram_address_
       // 0x2000 is the base address of vram
-      background_tile_id_latch_ = read(0x2000 + (vram_address.as_uint16 & 0x0FFF));
+      background_tile_id_latch_ = read(0x2000 + (vram_address_.as_uint16 & 0x0FFF));
     }
 
-    inline void read_next_background_tile_attribute(loopy_register vram_address)
+    inline void read_next_background_tile_attribute()
     {
       // XXX all of these bitwise | would make more sense as +
       std::uint16_t address = 
         0x23C0 | 
-        (vram_address.nametable_y << 11) |
-        (vram_address.nametable_x << 10) |
-        ((vram_address.coarse_y >> 2) << 3) |
-        (vram_address.coarse_x >> 2)
+        (vram_address_.nametable_y << 11) |
+        (vram_address_.nametable_x << 10) |
+        ((vram_address_.coarse_y >> 2) << 3) |
+        (vram_address_.coarse_x >> 2)
       ;
 
       background_tile_attribute_latch_ = read(address);
@@ -254,12 +580,12 @@ class ppu_renderer
       // rendering, based on the low two bits of
       // coarse_x and coarse_y
 
-      if(vram_address.coarse_y & 0b10)
+      if(vram_address_.coarse_y & 0b10)
       {
         background_tile_attribute_latch_ >>= 4;
       }
 
-      if(vram_address.coarse_x & 0b10)
+      if(vram_address_.coarse_x & 0b10)
       {
         background_tile_attribute_latch_ >>= 2;
       }
@@ -270,95 +596,96 @@ class ppu_renderer
     }
 
 
-    inline void read_next_background_tile_lsb(loopy_register vram_address, bool background_pattern_table_address)
+    inline void read_next_background_tile_lsb()
     {
       std::uint16_t address = 
-        (background_pattern_table_address << 12) +
+        (control_register_.background_pattern_table_address << 12) +
         (static_cast<std::uint16_t>(background_tile_id_latch_) << 4) +
-        (vram_address.fine_y + 0)
+        (vram_address_.fine_y + 0)
       ;
 
       background_tile_lsb_latch_ = read(address);
+      note_fetched_pattern_tile(address);
     }
 
 
-    inline void read_next_background_tile_msb(loopy_register vram_address, bool background_pattern_table_address)
+    inline void read_next_background_tile_msb()
     {
       std::uint16_t address = 
-        (background_pattern_table_address << 12) +
+        (control_register_.background_pattern_table_address << 12) +
         (static_cast<std::uint16_t>(background_tile_id_latch_) << 4) +
-        (vram_address.fine_y + 8)
+        (vram_address_.fine_y + 8)
       ;
 
       background_tile_msb_latch_ = read(address);
     }
 
 
-    inline void maybe_increment_x(bool enabled, loopy_register& vram_address)
+    inline void maybe_increment_x(bool enabled)
     {
       // XXX is this if necessary?
       if(enabled)
       {
-        if(vram_address.coarse_x == 31)
+        if(vram_address_.coarse_x == 31)
         {
-          vram_address.coarse_x = 0;
-          vram_address.nametable_x = !vram_address.nametable_x;
+          vram_address_.coarse_x = 0;
+          vram_address_.nametable_x = !vram_address_.nametable_x;
         }
         else
         {
-          vram_address.coarse_x++;
+          vram_address_.coarse_x++;
         }
       }
     }
 
-    inline void maybe_increment_y(bool enabled, loopy_register& vram_address)
+    inline void maybe_increment_y(bool enabled)
     {
       // XXX is this if necessary?
       if(enabled)
       {
-        if(vram_address.fine_y == 7)
+        if(vram_address_.fine_y == 7)
         {
-          vram_address.fine_y = 0;
+          vram_address_.fine_y = 0;
 
-          if(vram_address.coarse_y == 29)
+          if(vram_address_.coarse_y == 29)
           {
-            vram_address.coarse_y = 0;
-            vram_address.nametable_y = !vram_address.nametable_y;
+            vram_address_.coarse_y = 0;
+            vram_address_.nametable_y = !vram_address_.nametable_y;
           }
-          else if(vram_address.coarse_y == 31)
+          else if(vram_address_.coarse_y == 31)
           {
-            vram_address.coarse_y = 0;
+            vram_address_.coarse_y = 0;
           }
           else
           {
-            vram_address.coarse_y++;
+            vram_address_.coarse_y++;
           }
         }
         else
         {
-          vram_address.fine_y++;
+          vram_address_.fine_y++;
         }
       }
     }
 
-    inline void maybe_copy_x(bool enabled, loopy_register& vram_address, loopy_register tram_address)
+    inline void maybe_copy_x(bool enabled)
     {
       // XXX is this if necessary?
       if(enabled)
       {
-        vram_address.nametable_x = tram_address.nametable_x;
-        vram_address.coarse_x = tram_address.coarse_x;
+        vram_address_.nametable_x = tram_address_.nametable_x;
+        vram_address_.coarse_x = tram_address_.coarse_x;
       }
     }
 
-    inline void maybe_copy_y(bool enabled, loopy_register& vram_address, loopy_register tram_address)
+    inline void maybe_copy_y(bool enabled)
     {
       // XXX is this if necessary?
       if(enabled)
       {
-        vram_address.fine_y = tram_address.fine_y;
-        vram_address.nametable_y = tram_address.nametable_y;
-        vram_address.coarse_y = tram_address.coarse_y;
+        vram_address_.fine_y = tram_address_.fine_y;
+        vram_address_.nametable_y = tram_address_.nametable_y;
+        vram_address_.coarse_y = tram_address_.coarse_y;
       }
     }
 
@@ -386,27 +713,8 @@ class ppu_renderer
       }
     }
 
-    inline void maybe_update_active_sprites(bool enabled)
-    {
-      if(enabled)
-      {
-        for(std::uint8_t i = 0; i < active_sprites_.size(); ++i)
-        {
-          if(active_sprites_[i].second != 0)
-          {
-            active_sprites_[i].second--;
-          }
-          else
-          {
-            sprite_pattern_shift_register_low_[i]  <<= 1;
-            sprite_pattern_shift_register_high_[i] <<= 1;
-          }
-        }
-      }
-    }
-
-    // renders (palette_idx, pixel) using the current state of the renderer and fine_x
-    inline std::pair<std::uint8_t,std::uint8_t> maybe_render_background(bool enabled, std::uint8_t fine_x) const
+    // renders (palette_idx, pixel) using the current state of the renderer and fine_x_
+    inline std::pair<std::uint8_t,std::uint8_t> maybe_render_background(bool enabled) const
     {
       std::uint8_t palette_idx = 0;
       std::uint8_t pixel = 0;
@@ -414,7 +722,7 @@ class ppu_renderer
       if(enabled)
       {
         // fine x selects a bit from the bit planes represented in the shift registers
-        std::uint16_t mux = 0x8000 >> fine_x;
+        std::uint16_t mux = 0x8000 >> fine_x_;
 
         // construct the background pixel from two bit planes
         std::uint8_t pixel_plane_0 = (background_pattern_shift_register_low_  & mux) != 0;
@@ -482,13 +790,11 @@ class ppu_renderer
       return 4096 * sprite_pattern_table + 16 * tile_id + tile_row;
     }
 
-    inline void evaluate_sprites_for_next_scanline(bool use_tall_sprites, status_register_t& status)
+    inline void evaluate_sprites_for_next_scanline()
     {
-      std::uint8_t sprite_height = use_tall_sprites ? 16 : 8;
+      std::uint8_t sprite_height = control_register_.sprite_size ? 16 : 8;
 
       active_sprites_.clear();
-      sprite_pattern_shift_register_low_.fill(0);
-      sprite_pattern_shift_register_high_.fill(0);
 
       for(std::uint8_t i = 0; i < object_attributes_.size(); ++i)
       {
@@ -506,15 +812,22 @@ class ppu_renderer
           }
           else
           {
-            status.sprite_overflow = true;
+            if(not status_register_.sprite_overflow)
+            {
+              sprite_overflow_cycle_ = frame_cycle();
+            }
+
+            status_register_.sprite_overflow = true;
             break;
           }
         }
       }
     }
 
-    inline void read_sprites_for_next_scanline(control_register_t control)
+    inline void read_sprites_for_next_scanline()
     {
+      sprite_line_buffer_.fill({});
+
       for(std::uint8_t i = 0; i < active_sprites_.size(); ++i)
       {
         // XXX what happens when current_scanline_ is 261 below?
@@ -530,48 +843,58 @@ class ppu_renderer
         std::uint8_t sprite_row = current_scanline_ - active_sprite(i).y_position;
 
         // get the address of the row we need
-        std::uint16_t address = sprite_row_address(control, active_sprite(i), sprite_row);
+        std::uint16_t address = sprite_row_address(control_register_, active_sprite(i), sprite_row);
 
         // the zeroth byte at this address is the low bitplane
-        sprite_pattern_shift_register_low_[i] = maybe_flip_byte(active_sprite(i).flip_horizontally(), read(address + 0));
+        std::uint8_t pattern_low = maybe_flip_byte(active_sprite(i).flip_horizontally(), read(address + 0));
+        note_fetched_pattern_tile(address);
 
         // eight bytes later is the high bitplane
-        sprite_pattern_shift_register_high_[i] = maybe_flip_byte(active_sprite(i).flip_horizontally(), read(address + 8));
+        std::uint8_t pattern_high = maybe_flip_byte(active_sprite(i).flip_horizontally(), read(address + 8));
+
+        rasterize_sprite(i, pattern_low, pattern_high);
       }
     }
 
-    // returns (sprite_idx, prioritize_foreground, (palette_idx, color_idx))
-    inline std::tuple<std::uint8_t,bool,std::pair<std::uint8_t,std::uint8_t>> maybe_render_foreground(bool enabled)
+    // writes the given row of an active sprite into the sprite line buffer
+    // sprites are rasterized in priority order, so a pixel already covered by
+    // a non-transparent pixel of a previous sprite is left alone
+    inline void rasterize_sprite(std::uint8_t i, std::uint8_t pattern_low, std::uint8_t pattern_high)
     {
-      std::uint8_t sprite_idx = 8;
-      bool prioritize_foreground = false;
-      std::uint8_t palette_idx = 0;
-      std::uint8_t color_idx = 0;
+      object_attribute sprite = active_sprite(i);
 
-      if(enabled)
+      for(int col = 0; col < 8 and sprite.x_position + col < framebuffer_width; ++col)
       {
-        for(uint8_t i = 0; i < active_sprites_.size(); ++i)
+        // combine the bitplanes, most significant bit first
+        std::uint8_t color_idx_low  = (pattern_low  >> (7 - col)) & 0b1;
+        std::uint8_t color_idx_high = (pattern_high >> (7 - col)) & 0b1;
+        std::uint8_t color_idx = (color_idx_high << 1) | color_idx_low;
+
+        sprite_pixel& pixel = sprite_line_buffer_[sprite.x_position + col];
+
+        if(color_idx != 0 and pixel.color_idx == 0)
         {
-          if(active_sprite(i).x_position == 0) 
-          {
-            // combine the bitplanes stored in the shift registers
-            uint8_t color_idx_low  = (sprite_pattern_shift_register_low_[i]  & 0x80) != 0;
-            uint8_t color_idx_high = (sprite_pattern_shift_register_high_[i] & 0x80) != 0;
-            color_idx = (color_idx_high << 1) | color_idx_low;
-            
-            // stop at the first non-transparent sprite we encounter
-            if(color_idx != 0)
-            {
-              sprite_idx = i;
-              prioritize_foreground = active_sprite(i).prioritize_foreground();
-              palette_idx = active_sprite(i).palette_id();
-              break;
-            }				
-          }
-        }		
+          pixel.color_idx = color_idx;
+          pixel.palette_idx = sprite.palette_id();
+          pixel.prioritize_foreground = sprite.prioritize_foreground();
+          pixel.is_sprite_zero = (active_sprites_[i].first == 0);
+        }
       }
+    }
+
+    // returns the rasterized sprite pixel at the current cycle
+    inline sprite_pixel maybe_render_foreground(bool enabled) const
+    {
+      sprite_pixel result{};
 
-      return {sprite_idx, prioritize_foreground, {palette_idx,color_idx}};
+      // the PPU idles on cycle 0, so we subtract 1 from current_scanline_cycle_ to find the pixel's x coordinate
+      if(enabled and current_scanline_ < framebuffer_height and
+         0 < current_scanline_cycle_ and current_scanline_cycle_ <= framebuffer_width)
+      {
+        result = sprite_line_buffer_[current_scanline_cycle_ - 1];
+      }
+
+      return result;
     }
 
     // foreground: (fg_palette_idx, fg_color_idx)
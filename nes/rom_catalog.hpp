@@ -0,0 +1,344 @@
+#pragma once
+
+#include "hash.hpp"
+#include "mapped_file.hpp"
+#include "mapper.hpp"
+#include "rom_image.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+
+namespace nes
+{
+
+
+// rom_catalog is an index of the iNES files in a set of directories
+// each entry describes a ROM's contents and what a cartridge made from it needs, so choosing among many ROMs
+// doesn't require opening any of them
+//
+// the catalog is kept in a file which is mapped into memory rather than read. updating the catalog only reads
+// the ROMs whose size or modification time differ from their entries, and replaces the file all at once,
+// so catalogs which are already open are unaffected
+class rom_catalog
+{
+  public:
+    // whether or not a cartridge can be made from the ROM
+    enum status_kind : std::uint8_t
+    {
+      supported, unsupported_mapper, invalid
+    };
+
+    // entries are stored in the file as they are in memory
+    struct entry
+    {
+      // the size and modification time of the file when it was indexed
+      std::uint64_t file_size;
+      std::int64_t modification_time;
+
+      // the file's path, among the paths which follow the entries
+      std::uint32_t path_offset;
+      std::uint32_t path_size;
+
+      std::uint32_t prg_rom_crc32;
+      std::uint32_t chr_rom_crc32;
+      std::array<std::uint8_t,20> prg_rom_sha1;
+      std::array<std::uint8_t,20> chr_rom_sha1;
+
+      std::uint32_t prg_rom_size;
+      std::uint32_t chr_rom_size;
+      std::uint32_t prg_ram_size;
+      std::uint32_t prg_nvram_size;
+      std::uint32_t chr_ram_size;
+
+      std::uint16_t mapper_id;
+      std::uint8_t submapper_id;
+      std::uint8_t nametable_mirroring; // a mapper::nametable_mirroring_kind
+      std::uint8_t timing;              // an ines_file_header::timing_kind
+      bool battery_present;
+      bool is_nes2;
+      status_kind status;
+      std::uint8_t unused[4];
+    };
+
+    static_assert(sizeof(entry) == 104, "rom_catalog::entry must match the layout of the file");
+
+    inline rom_catalog()
+      : file_{},
+        entries_{},
+        paths_{},
+        num_indexed_{0}
+    {}
+
+    // maps an existing catalog file into memory
+    inline static rom_catalog open(const std::filesystem::path& filename)
+    {
+      rom_catalog result;
+      result.file_ = mapped_file::open(filename);
+
+      std::span<const std::uint8_t> bytes = result.file_.bytes();
+      if(bytes.size() < sizeof(file_header))
+      {
+        throw std::runtime_error(fmt::format("rom_catalog::open: {} is not a ROM catalog", filename.string()));
+      }
+
+      file_header header;
+      std::memcpy(&header, bytes.data(), sizeof(header));
+
+      std::size_t entries_size = std::size_t{header.num_entries} * sizeof(entry);
+      if(std::memcmp(header.magic, file_magic, sizeof(header.magic)) != 0 or header.version != file_version or
+         sizeof(file_header) + entries_size + header.paths_size != bytes.size())
+      {
+        throw std::runtime_error(fmt::format("rom_catalog::open: {} is not a ROM catalog of this version", filename.string()));
+      }
+
+      result.entries_ = std::span(reinterpret_cast<const entry*>(bytes.data() + sizeof(file_header)), header.num_entries);
+      result.paths_ = std::string_view(reinterpret_cast<const char*>(bytes.data() + sizeof(file_header) + entries_size), header.paths_size);
+
+      for(const entry& e: result.entries_)
+      {
+        if(std::size_t{e.path_offset} + e.path_size > result.paths_.size())
+        {
+          throw std::runtime_error(fmt::format("rom_catalog::open: {} is corrupt", filename.string()));
+        }
+      }
+
+      return result;
+    }
+
+    // indexes the iNES files found beneath the given directories with num_threads threads and replaces the catalog file
+    // with the result, creating it if necessary. entries of files which are no longer found are dropped
+    inline static rom_catalog update(const std::filesystem::path& filename, std::span<const std::filesystem::path> directories,
+                                     unsigned int num_threads = std::thread::hardware_concurrency())
+    {
+      // a catalog which can't be used is rebuilt from scratch
+      rom_catalog previous;
+      try
+      {
+        if(std::filesystem::exists(filename))
+        {
+          previous = open(filename);
+        }
+      }
+      catch(std::exception&)
+      {
+      }
+
+      std::vector<std::string> paths = find_rom_files(directories);
+
+      // each file is examined by whichever thread gets to it first, and its result goes in its own place
+      std::vector<entry> entries(paths.size());
+      std::atomic<std::size_t> next_file{0};
+      std::atomic<std::size_t> num_indexed{0};
+
+      auto examine_files = [&]
+      {
+        for(std::size_t i = next_file++; i < paths.size(); i = next_file++)
+        {
+          std::error_code error;
+          std::uint64_t file_size = std::filesystem::file_size(paths[i], error);
+          std::int64_t modification_time = std::filesystem::last_write_time(paths[i], error).time_since_epoch().count();
+
+          const entry* found = previous.find(paths[i]);
+          if(found and found->file_size == file_size and found->modification_time == modification_time)
+          {
+            entries[i] = *found;
+          }
+          else
+          {
+            entries[i] = index_file(paths[i]);
+            ++num_indexed;
+          }
+
+          entries[i].file_size = file_size;
+          entries[i].modification_time = modification_time;
+        }
+      };
+
+      std::vector<std::thread> threads;
+      for(unsigned int i = 1; i < num_threads; ++i)
+      {
+        threads.emplace_back(examine_files);
+      }
+
+      examine_files();
+
+      for(std::thread& t: threads)
+      {
+        t.join();
+      }
+
+      write_file(filename, paths, entries);
+
+      rom_catalog result = open(filename);
+      result.num_indexed_ = num_indexed;
+      return result;
+    }
+
+    // the entries stay where they are, so the spans into them remain valid
+    rom_catalog(rom_catalog&&) = default;
+    rom_catalog& operator=(rom_catalog&&) = default;
+
+    // entries are sorted by path
+    inline std::span<const entry> entries() const
+    {
+      return entries_;
+    }
+
+    inline std::string_view path(const entry& e) const
+    {
+      return paths_.substr(e.path_offset, e.path_size);
+    }
+
+    // returns nullptr if the file isn't in the catalog
+    inline const entry* find(std::string_view path) const
+    {
+      auto found = std::lower_bound(entries_.begin(), entries_.end(), path, [this](const entry& e, std::string_view p)
+      {
+        return this->path(e) < p;
+      });
+
+      return found != entries_.end() and this->path(*found) == path ? &*found : nullptr;
+    }
+
+    // returns the number of ROMs which were read by the update which produced this catalog
+    // the rest were unchanged since the previous update
+    inline std::size_t num_indexed() const
+    {
+      return num_indexed_;
+    }
+
+  private:
+    constexpr static char file_magic[8] = {'N','E','S','R','O','M','C','T'};
+    constexpr static std::uint32_t file_version = 1;
+
+    // the file is this header, followed by the entries, followed by their paths
+    struct file_header
+    {
+      char magic[8];
+      std::uint32_t version;
+      std::uint32_t num_entries;
+      std::uint64_t paths_size;
+    };
+
+    // returns the sorted paths of the files which are named like iNES files beneath the given directories
+    inline static std::vector<std::string> find_rom_files(std::span<const std::filesystem::path> directories)
+    {
+      std::vector<std::string> result;
+
+      for(const std::filesystem::path& directory: directories)
+      {
+        auto options = std::filesystem::directory_options::skip_permission_denied;
+        for(const std::filesystem::directory_entry& file: std::filesystem::recursive_directory_iterator{directory, options})
+        {
+          std::string extension = file.path().extension().string();
+          std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+
+          if(extension == ".nes" and file.is_regular_file())
+          {
+            result.push_back(file.path().lexically_normal().string());
+          }
+        }
+      }
+
+      // directories may overlap
+      std::sort(result.begin(), result.end());
+      result.erase(std::unique(result.begin(), result.end()), result.end());
+
+      return result;
+    }
+
+    inline static entry index_file(const std::string& filename)
+    {
+      entry result{};
+      result.status = invalid;
+
+      try
+      {
+        rom_image image = rom_image::map_file(filename);
+        const ines_file_header& header = image.header();
+
+        result.prg_rom_crc32 = crc32(image.prg_rom());
+        result.chr_rom_crc32 = crc32(image.chr_rom());
+        result.prg_rom_sha1 = sha1(image.prg_rom());
+        result.chr_rom_sha1 = sha1(image.chr_rom());
+
+        result.prg_rom_size = header.prg_rom_size();
+        result.chr_rom_size = header.chr_rom_size();
+        result.prg_ram_size = header.prg_ram_size();
+        result.prg_nvram_size = header.prg_nvram_size();
+        result.chr_ram_size = header.chr_ram_size();
+
+        result.mapper_id = header.mapper_id();
+        result.submapper_id = header.submapper_id();
+        result.nametable_mirroring = header.mirroring();
+        result.timing = header.timing();
+        result.battery_present = header.battery_present();
+        result.is_nes2 = header.is_nes2();
+        result.status = mapper_supported(header.mapper_id()) ? supported : unsupported_mapper;
+      }
+      catch(std::exception&)
+      {
+        // files which can't be read as ROMs keep an entry, so that they aren't read again until they change
+      }
+
+      return result;
+    }
+
+    // writes the catalog beside filename and then moves it into place
+    inline static void write_file(const std::filesystem::path& filename, const std::vector<std::string>& paths, std::vector<entry>& entries)
+    {
+      file_header header{};
+      std::memcpy(header.magic, file_magic, sizeof(header.magic));
+      header.version = file_version;
+      header.num_entries = entries.size();
+
+      for(std::size_t i = 0; i < entries.size(); ++i)
+      {
+        entries[i].path_offset = header.paths_size;
+        entries[i].path_size = paths[i].size();
+        header.paths_size += paths[i].size();
+      }
+
+      std::filesystem::path temporary_filename = filename;
+      temporary_filename += ".tmp";
+
+      {
+        std::ofstream os{temporary_filename, std::ios::binary};
+        os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        os.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(entry));
+        for(const std::string& path: paths)
+        {
+          os.write(path.data(), path.size());
+        }
+
+        if(not os.flush())
+        {
+          throw std::runtime_error(fmt::format("rom_catalog::write_file: Couldn't write {}", temporary_filename.string()));
+        }
+      }
+
+      std::filesystem::rename(temporary_filename, filename);
+    }
+
+    mapped_file file_;
+    std::span<const entry> entries_;
+    std::string_view paths_;
+    std::size_t num_indexed_;
+};
+
+
+} // end nes
+
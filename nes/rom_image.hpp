@@ -0,0 +1,290 @@
+#pragma once
+
+#include "mapped_file.hpp"
+#include "mapper.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <istream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+
+namespace nes
+{
+
+
+// see https://www.nesdev.org/wiki/INES#iNES_file_format
+// and https://www.nesdev.org/wiki/NES_2.0 for the fields which NES 2.0 headers add
+struct ines_file_header
+{
+  char name[4];
+  std::uint8_t num_prg_rom_chunks;
+  std::uint8_t num_chr_rom_chunks;
+  std::uint8_t flags_6;
+  std::uint8_t flags_7;
+  std::uint8_t flags_8;
+  std::uint8_t flags_9;
+  std::uint8_t flags_10;
+  std::uint8_t flags_11;
+  std::uint8_t flags_12;
+  std::uint8_t flags_13;
+  std::uint8_t flags_14;
+  std::uint8_t flags_15;
+
+  // see https://www.nesdev.org/wiki/NES_2.0#CPU/PPU_Timing
+  enum timing_kind
+  {
+    ntsc, pal, multiple_region, dendy
+  };
+
+  inline ines_file_header(std::span<const std::uint8_t> bytes)
+  {
+    if(bytes.size() < sizeof(ines_file_header) or std::memcmp(bytes.data(), "NES\x1A", 4) != 0)
+    {
+      throw std::runtime_error("ines_file_header: Not an iNES file");
+    }
+
+    std::memcpy(this, bytes.data(), sizeof(ines_file_header));
+  }
+
+  inline bool is_nes2() const
+  {
+    return (flags_7 & 0x0C) == 0x08;
+  }
+
+  inline int mapper_id() const
+  {
+    if(is_nes2())
+    {
+      return ((flags_8 & 0x0F) << 8) | (flags_7 & 0xF0) | (flags_6 >> 4);
+    }
+
+    // some old dumping tools wrote their name over bytes 7 - 15, so the high nibble of the mapper is only trustworthy
+    // when the end of the header is clear
+    // see https://www.nesdev.org/wiki/INES#Variant_comparison
+    if(flags_12 != 0 or flags_13 != 0 or flags_14 != 0 or flags_15 != 0)
+    {
+      return flags_6 >> 4;
+    }
+
+    return (flags_7 & 0xF0) | (flags_6 >> 4);
+  }
+
+  inline int submapper_id() const
+  {
+    return is_nes2() ? flags_8 >> 4 : 0;
+  }
+
+  inline bool trainer_present() const
+  {
+    return flags_6 & 0x04;
+  }
+
+  // whether or not the cartridge's prg ram is kept by a battery while the power is off
+  inline bool battery_present() const
+  {
+    return flags_6 & 0x02;
+  }
+
+  inline mapper::nametable_mirroring_kind mirroring() const
+  {
+    if(flags_6 & 0x08)
+    {
+      return mapper::four_screen;
+    }
+
+    return (flags_6 & 0x01) ? mapper::vertical : mapper::horizontal;
+  }
+
+  inline std::size_t prg_rom_size() const
+  {
+    return is_nes2() ? nes2_rom_size(num_prg_rom_chunks, flags_9 & 0x0F, 16384) : num_prg_rom_chunks * 16384;
+  }
+
+  inline std::size_t chr_rom_size() const
+  {
+    return is_nes2() ? nes2_rom_size(num_chr_rom_chunks, flags_9 >> 4, 8192) : num_chr_rom_chunks * 8192;
+  }
+
+  // the sizes of the cartridge's volatile prg ram and its battery-backed prg ram
+  // iNES headers only give a total size, which is 8KB when it's 0, and which is all battery-backed if there is a battery
+  inline std::size_t prg_ram_size() const
+  {
+    if(is_nes2()) return nes2_ram_size(flags_10 & 0x0F);
+    return battery_present() ? 0 : ines_prg_ram_size();
+  }
+
+  inline std::size_t prg_nvram_size() const
+  {
+    if(is_nes2()) return nes2_ram_size(flags_10 >> 4);
+    return battery_present() ? ines_prg_ram_size() : 0;
+  }
+
+  // the size of the cartridge's chr ram, which iNES headers imply is 8KB when there is no chr rom
+  inline std::size_t chr_ram_size() const
+  {
+    if(is_nes2()) return nes2_ram_size(flags_11 & 0x0F) + nes2_ram_size(flags_11 >> 4);
+    return num_chr_rom_chunks == 0 ? 8192 : 0;
+  }
+
+  inline timing_kind timing() const
+  {
+    if(is_nes2()) return timing_kind(flags_12 & 0b11);
+    return (flags_9 & 0x01) ? pal : ntsc;
+  }
+
+  inline std::size_t ines_prg_ram_size() const
+  {
+    return std::max(1, int(flags_8)) * 8192;
+  }
+
+  // rom sizes are given in chunks with a most significant nibble, or when that nibble is 0xF, as an exponent and multiplier
+  inline static std::size_t nes2_rom_size(std::uint8_t lsb, std::uint8_t msb, std::size_t chunk_size)
+  {
+    if(msb == 0x0F)
+    {
+      return (std::size_t{1} << (lsb >> 2)) * ((lsb & 0b11) * 2 + 1);
+    }
+
+    return ((msb << 8) | lsb) * chunk_size;
+  }
+
+  // ram sizes are given as shift counts
+  inline static std::size_t nes2_ram_size(std::uint8_t shift_count)
+  {
+    return shift_count == 0 ? 0 : std::size_t{64} << shift_count;
+  }
+};
+
+static_assert(sizeof(ines_file_header) == 16, "ines_file_header must match the layout of the file");
+
+
+// rom_image is the read-only contents of an iNES file
+// every cartridge made from the same ROM shares one image, so only the writable parts of a cartridge are per instance
+class rom_image
+{
+  public:
+    // returns the image of the given file, which is mapped into memory rather than read
+    // while any cartridge holds the image, opening the same file again returns the same image
+    inline static std::shared_ptr<const rom_image> open(const std::filesystem::path& filename)
+    {
+      static std::mutex mutex;
+      static std::map<std::filesystem::path, std::weak_ptr<const rom_image>> open_images;
+
+      std::filesystem::path key = std::filesystem::weakly_canonical(filename);
+
+      std::lock_guard lock{mutex};
+
+      auto found = open_images.find(key);
+      if(found != open_images.end())
+      {
+        if(std::shared_ptr<const rom_image> result = found->second.lock())
+        {
+          return result;
+        }
+      }
+
+      // forget the images which are no longer held, so the map only grows with the number of images in use
+      std::erase_if(open_images, [](const auto& entry)
+      {
+        return entry.second.expired();
+      });
+
+      std::shared_ptr<const rom_image> result = std::make_shared<const rom_image>(map_file(filename));
+      open_images[key] = result;
+      return result;
+    }
+
+    // returns an image of the given file which isn't shared, e.g. for a tool which only inspects the file
+    inline static rom_image map_file(const std::filesystem::path& filename)
+    {
+      return rom_image{mapped_file::open(filename)};
+    }
+
+    // the caller's bytes are used in place, so they must outlive the image
+    inline rom_image(std::span<const std::uint8_t> bytes)
+      : bytes_{bytes},
+        header_{bytes_}
+    {
+      locate_chunks();
+    }
+
+    inline rom_image(std::vector<std::uint8_t>&& bytes)
+      : owned_bytes_{std::move(bytes)},
+        bytes_{owned_bytes_},
+        header_{bytes_}
+    {
+      locate_chunks();
+    }
+
+    inline rom_image(std::istream& is)
+      : rom_image{std::vector<std::uint8_t>(std::istreambuf_iterator<char>{is}, std::istreambuf_iterator<char>{})}
+    {}
+
+    rom_image(const rom_image&) = delete;
+    rom_image& operator=(const rom_image&) = delete;
+
+    // the bytes stay where they are, so the spans into them remain valid
+    rom_image(rom_image&&) = default;
+
+    inline const ines_file_header& header() const
+    {
+      return header_;
+    }
+
+    inline std::span<const std::uint8_t> prg_rom() const
+    {
+      return prg_rom_;
+    }
+
+    // this is empty for cartridges with chr ram
+    inline std::span<const std::uint8_t> chr_rom() const
+    {
+      return chr_rom_;
+    }
+
+  private:
+    inline rom_image(mapped_file&& file)
+      : file_{std::move(file)},
+        bytes_{file_.bytes()},
+        header_{bytes_}
+    {
+      locate_chunks();
+    }
+
+    inline void locate_chunks()
+    {
+      std::size_t prg_rom_size = header_.prg_rom_size();
+      std::size_t chr_rom_size = header_.chr_rom_size();
+
+      // if a 512B trainer is present, ignore it
+      std::size_t offset = sizeof(ines_file_header) + (header_.trainer_present() ? 512 : 0);
+
+      if(prg_rom_size == 0 or offset + prg_rom_size + chr_rom_size > bytes_.size())
+      {
+        throw std::runtime_error("rom_image: ROM is truncated");
+      }
+
+      prg_rom_ = bytes_.subspan(offset, prg_rom_size);
+      chr_rom_ = bytes_.subspan(offset + prg_rom_size, chr_rom_size);
+    }
+
+    std::vector<std::uint8_t> owned_bytes_;
+    mapped_file file_;
+    std::span<const std::uint8_t> bytes_;
+
+    ines_file_header header_;
+    std::span<const std::uint8_t> prg_rom_;
+    std::span<const std::uint8_t> chr_rom_;
+};
+
+
+} // end nes
+
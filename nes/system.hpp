@@ -2,11 +2,15 @@
 
 #include "apu.hpp"
 #include "bus.hpp"
+#include "capture.hpp"
 #include "cartridge.hpp"
 #include "cpu.hpp"
 #include "graphics_bus.hpp"
 #include "ppu.hpp"
 #include <array>
+#include <bit>
+#include <filesystem>
+#include <memory>
 #include <span>
 
 
@@ -30,16 +34,32 @@ class system
     constexpr static std::uint8_t left_button_bitmask   = 0b00000010;
     constexpr static std::uint8_t right_button_bitmask  = 0b00000001;
 
+    // a game with battery-backed ram saves to a file named after the rom, with the extension .sav
+    // only the first of several instances of the same rom gets the save file. the others, and games whose save file
+    // can't be created, e.g. in a read-only directory, run with volatile prg ram
     system(const char* rom_filename)
+      : system{rom_image::open(rom_filename), std::filesystem::path{rom_filename}.replace_extension(".sav")}
+    {}
+
+    // systems made from the same rom image share it, so many instances of a game are cheap to create
+    // battery-backed ram is only saved when a save file is given, since instances can't share one
+    system(std::shared_ptr<const rom_image> rom, const std::filesystem::path& save_filename = {})
       : cpu_{bus_},
         ppu_{graphics_bus_, framebuffer_},
         controllers_{{}},
         wram_{{}},
-        cart_{rom_filename},
+        cart_{rom, save_filename},
         bus_{controllers_, cart_, wram_, ppu_, apu_},
         vram_{},
-        graphics_bus_{cart_, vram_}
+        graphics_bus_{cart_, vram_},
+        capture_{},
+        cpu_cycle_{0},
+        pattern_table_images_{},
+        stale_pattern_tiles_{}
     {
+      // nothing has drawn the pattern tables yet
+      stale_pattern_tiles_.fill(~std::uint64_t{0});
+
       for(int row = 0; row < framebuffer_height; ++row)
       {
         for(int col = 0; col < framebuffer_width; ++col)
@@ -47,6 +67,84 @@ class system
           framebuffer_[row * framebuffer_width + col] = {0, 255, 0};
         }
       }
+
+      // the renderer may reuse the previous frame only while the pattern tables and nametables stay put
+      cart_.on_graphics_changing([this]
+      {
+        ppu_.invalidate_frame();
+      });
+    }
+
+    // resets the system, as when it is powered on, and brings the ppu and apu up to the cpu
+    inline void reset()
+    {
+      std::size_t num_cpu_cycles = cpu_.reset();
+      catch_up_to_cpu(num_cpu_cycles);
+      cpu_cycle_ = num_cpu_cycles;
+    }
+
+    // the most number of audio samples which a call to run_frame may produce
+    constexpr static std::size_t max_audio_samples_per_frame = band_limited_buffer::max_samples_per_frame;
+
+    // emulates until the ppu completes a frame by entering the vertical blank period
+    // writes the audio samples produced since the previous frame to audio_samples and returns the number written
+    // the frame and its audio are handed to the attached capture, if any
+    inline std::size_t run_frame(std::span<float> audio_samples)
+    {
+      bool frame_complete = false;
+
+      while(not frame_complete)
+      {
+        std::size_t num_cpu_cycles = 0;
+
+        if(bus_.dma_in_progress())
+        {
+          // the cpu is suspended during a dma
+          num_cpu_cycles = bus_.execute_dma(cpu_cycle_);
+        }
+        else if(cart_.interrupt_request() and not cpu_.interrupt_request_disable_flag())
+        {
+          // the cartridge asserted the interrupt request line during the previous instruction,
+          // so the cpu takes the interrupt before the next one
+          num_cpu_cycles = cpu_.interrupt_request();
+        }
+        else
+        {
+          // execute the next instruction
+          num_cpu_cycles = cpu_.step_instruction();
+
+          // execute any nonmaskable interrupt
+          if(ppu_.nmi)
+          {
+            num_cpu_cycles += cpu_.nonmaskable_interrupt();
+            ppu_.nmi = false;
+          }
+        }
+
+        frame_complete = catch_up_to_cpu(num_cpu_cycles);
+        cpu_cycle_ += num_cpu_cycles;
+      }
+
+      for(std::size_t i = 0; i < stale_pattern_tiles_.size(); ++i)
+      {
+        stale_pattern_tiles_[i] |= ppu_.changed_pattern_tiles()[i];
+      }
+
+      std::size_t num_audio_samples = apu_.read_samples(audio_samples);
+
+      if(capture_)
+      {
+        capture_->submit_frame(framebuffer());
+        capture_->submit_audio(audio_samples.first(num_audio_samples));
+      }
+
+      return num_audio_samples;
+    }
+
+    // returns the number of cpu cycles emulated since reset
+    inline std::size_t cpu_cycle() const
+    {
+      return cpu_cycle_;
     }
 
     inline void set_controller(std::uint8_t idx, std::uint8_t state)
@@ -99,6 +197,22 @@ class system
       return graphics_bus_;
     }
 
+    // while a capture is attached, completed frames and audio samples are handed to it as they are produced
+    inline void attach_capture(nes::capture& c)
+    {
+      capture_ = &c;
+    }
+
+    inline void detach_capture()
+    {
+      capture_ = nullptr;
+    }
+
+    inline nes::capture* capture() const
+    {
+      return capture_;
+    }
+
     inline std::span<const std::uint8_t,256> zero_page() const
     {
       std::span all = wram_;
@@ -112,6 +226,62 @@ class system
       return framebuffer_;
     }
 
+    // returns whether or not the most recent frame is identical to the frame before it
+    // consumers can skip uploading or encoding the framebuffer when this is true
+    inline bool frame_unchanged() const
+    {
+      return ppu_.frame_unchanged();
+    }
+
+    // returns which 8 * 8 pixel tiles of the most recent frame differ from the frame before it
+    // element i has bit j set when the tile covering rows [8i, 8i + 8) and columns [8j, 8j + 8) changed
+    // consumers can upload or encode only the changed tiles or rows of tiles
+    inline std::span<const ppu::tile_row_mask, ppu::num_tile_rows> changed_tiles() const
+    {
+      return ppu_.changed_tiles();
+    }
+
+    // returns whether or not any tile overlapping the given scanline of the most recent frame changed
+    inline bool scanline_changed(int scanline) const
+    {
+      return changed_tiles()[scanline / ppu::tile_dim] != 0;
+    }
+
+    // while disabled, the apu tracks only the state which games can read back and produces silence
+    // see apu::enable_synthesis
+    inline void enable_audio(bool enable)
+    {
+      apu_.enable_synthesis(enable);
+    }
+
+    // while enabled, the ppu produces planes which describe how each pixel of the framebuffer was composited
+    // see ppu_renderer::layer_planes
+    inline void enable_layer_planes(bool enable)
+    {
+      ppu_.enable_layer_planes(enable);
+    }
+
+    // the index into palette memory of each pixel's background color, or 0 where the background is transparent
+    // this is empty while the layer planes are disabled
+    inline std::span<const std::uint8_t> background_plane() const
+    {
+      return ppu_.planes() ? std::span<const std::uint8_t>{ppu_.planes()->background} : std::span<const std::uint8_t>{};
+    }
+
+    // the index into palette memory of each pixel's sprite color, or 0 where no sprite is opaque
+    // this is empty while the layer planes are disabled
+    inline std::span<const std::uint8_t> sprite_plane() const
+    {
+      return ppu_.planes() ? std::span<const std::uint8_t>{ppu_.planes()->sprites} : std::span<const std::uint8_t>{};
+    }
+
+    // which layer each pixel came from and its sprite priority, see ppu_renderer::backdrop_source and friends
+    // this is empty while the layer planes are disabled
+    inline std::span<const std::uint8_t> source_plane() const
+    {
+      return ppu_.planes() ? std::span<const std::uint8_t>{ppu_.planes()->sources} : std::span<const std::uint8_t>{};
+    }
+
     constexpr static std::uint16_t nametable_size = 1024;
 
     inline std::span<const std::uint8_t, nametable_size> nametable(int i) const
@@ -122,44 +292,33 @@ class system
 
     constexpr static int pattern_table_dim = 128;
 
-    inline auto pattern_table_as_image(int i, int palette) const
+    // the images are kept between calls, and only the tiles which have changed since are drawn again
+    inline const std::array<ppu::rgb, pattern_table_dim*pattern_table_dim>& pattern_table_as_image(int i, int palette) const
     {
-      std::array<ppu::rgb, pattern_table_dim*pattern_table_dim> result;
-
-      // a pattern table is 16 * 16 tiles
-      // each tile is 8 * 8 pixels
-
-      // XXX can't we just do this linearly?
-      for(uint16_t tile_y = 0; tile_y < 16; ++tile_y)
-      {
-        for(uint16_t tile_x = 0; tile_x < 16; ++tile_x)
-        {
-          // 2 * pattern_table_dim because there are two bytes which describe each tile
-          int offset = tile_y * (2 * pattern_table_dim) + tile_x * 16;
+      pattern_table_image& image = pattern_table_images_[i];
 
-          for(uint16_t row = 0; row < 8; ++row)
-          {
-            uint8_t tile_lsb = graphics_bus_.read(i * 0x1000 + offset + row + 0);
-            uint8_t tile_msb = graphics_bus_.read(i * 0x1000 + offset + row + 8);
+      std::array<ppu::rgb,4> colors = palette_as_image(palette);
+      bool redraw = colors != image.colors;
+      image.colors = colors;
 
-            for(uint16_t col = 0; col < 8; ++col)
-            {
-              uint8_t pixel = (tile_lsb & 0x01) + (tile_msb & 0x01);
-              tile_lsb >>= 1;
-              tile_msb >>= 1;
+      // the tiles changed before the current frame began were collected from the ppu,
+      // and the cartridge still marks those changed since
+      constexpr int num_tiles = cartridge::num_pattern_tiles / 2;
+      constexpr int num_words = num_tiles / 64;
 
-              int x = 8 * tile_x + (7 - col);
-              int y = 8 * tile_y + row;
-
-              ppu::rgb color = ppu_.as_rgb(palette, pixel);
+      for(int word = i * num_words; word < (i + 1) * num_words; ++word)
+      {
+        std::uint64_t stale = redraw ? ~std::uint64_t{0} : stale_pattern_tiles_[word] | cart_.dirty_tiles()[word];
+        stale_pattern_tiles_[word] = 0;
 
-              result[pattern_table_dim*y + x] = color;
-            }
-          }
+        for(; stale; stale &= stale - 1)
+        {
+          int tile = 64 * word + std::countr_zero(stale);
+          draw_pattern_tile(tile, image);
         }
       }
 
-      return result;
+      return image.pixels;
     }
 
     std::array<ppu::rgb,4> palette_as_image(int palette_idx) const
@@ -173,6 +332,49 @@ class system
     }
 
   private:
+    struct pattern_table_image
+    {
+      std::array<ppu::rgb, pattern_table_dim*pattern_table_dim> pixels;
+
+      // the colors of the palette which the pixels were drawn with
+      std::array<ppu::rgb,4> colors;
+    };
+
+    // draws one of the 512 tiles of the pattern tables into the image of its table
+    inline void draw_pattern_tile(int tile, pattern_table_image& image) const
+    {
+      // a pattern table is 16 * 16 tiles, each of 8 * 8 pixels
+      // each row of a tile is described by two bytes, eight bytes apart
+      int tile_x = tile % 16;
+      int tile_y = (tile / 16) % 16;
+
+      for(int row = 0; row < 8; ++row)
+      {
+        std::uint8_t tile_lsb = graphics_bus_.read(16 * tile + row + 0);
+        std::uint8_t tile_msb = graphics_bus_.read(16 * tile + row + 8);
+
+        for(int col = 0; col < 8; ++col)
+        {
+          // the most significant bit is the leftmost pixel
+          std::uint8_t pixel = ((tile_lsb >> (7 - col)) & 0x01) | (((tile_msb >> (7 - col)) & 0x01) << 1);
+
+          image.pixels[pattern_table_dim * (8 * tile_y + row) + 8 * tile_x + col] = image.colors[pixel];
+        }
+      }
+    }
+
+    // steps the apu and ppu through the given number of cpu cycles
+    // returns whether or not the ppu entered the vertical blank period
+    inline bool catch_up_to_cpu(std::size_t num_cpu_cycles)
+    {
+      for(std::size_t i = 0; i < num_cpu_cycles; ++i)
+      {
+        apu_.step_cycle();
+      }
+
+      return ppu_.advance(3 * num_cpu_cycles);
+    }
+
     std::array<ppu::rgb, framebuffer_width * framebuffer_height> framebuffer_;
 
     nes::cpu cpu_;
@@ -184,6 +386,12 @@ class system
     nes::bus bus_;
     std::array<std::uint8_t, 2*nametable_size> vram_;
     nes::graphics_bus graphics_bus_;
+    nes::capture* capture_;
+    std::size_t cpu_cycle_;
+
+    // pattern table images are drawn for debugging views on demand, so they are updated from const member functions
+    mutable std::array<pattern_table_image,2> pattern_table_images_;
+    mutable cartridge::pattern_tile_mask stale_pattern_tiles_;
 };
 
 
@@ -0,0 +1,87 @@
+#include "nes/capture.hpp"
+#include "nes/nsf.hpp"
+#include <chrono>
+#include <fmt/format.h>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+
+int main(int argc, const char** argv)
+{
+  if(argc < 2 or argc > 6)
+  {
+    fmt::print("usage: {} filename [song [num_seconds [audio_filename [sample_rate]]]]\n", argv[0]);
+    fmt::print("  renders num_seconds of a song, numbered from 1, as fast as possible and reports the speed\n");
+    fmt::print("  audio is recorded as wav at sample_rate, which is {} by default\n", nes::apu::default_sample_rate);
+    return 0;
+  }
+
+  try
+  {
+    nes::nsf_player player{argv[1]};
+
+    int song = argc > 2 ? std::stoi(argv[2]) - 1 : player.starting_song();
+    double num_seconds = argc > 3 ? std::stod(argv[3]) : 60;
+    double sample_rate = argc > 5 ? std::stod(argv[5]) : nes::apu::default_sample_rate;
+
+    fmt::print(stderr, "{} by {} ({}), song {} of {}, played at {:.2f} Hz\n",
+      player.song_name(), player.artist(), player.copyright(), song + 1, player.num_songs(), player.play_rate());
+
+    // record audio if requested
+    std::optional<nes::capture> capture;
+    if(argc > 4)
+    {
+      nes::capture::options opts;
+      opts.audio_filename = argv[4];
+      opts.audio_sample_rate = sample_rate;
+
+      // a rendered song is only ever listened to, so it gets the nes's output filters
+      opts.filter_audio = true;
+      capture.emplace(opts);
+    }
+
+    player.apu().set_sample_rate(sample_rate);
+    player.start_song(song);
+
+    std::vector<float> block(4096);
+    std::size_t num_samples = num_seconds * sample_rate;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for(std::size_t i = 0; i < num_samples; i += block.size())
+    {
+      std::span<float> samples = std::span(block).first(std::min(block.size(), num_samples - i));
+      player.render(samples);
+
+      if(capture)
+      {
+        capture->submit_audio(samples);
+      }
+    }
+
+    if(capture)
+    {
+      capture->close();
+
+      if(not capture->error().empty())
+      {
+        fmt::print(stderr, "{}\n", capture->error());
+      }
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    double rendered_seconds = num_samples / sample_rate;
+    fmt::print(stderr, "rendered {:.1f} s of audio in {:.3f} s: {:.1f} seconds of audio per second\n",
+      rendered_seconds, elapsed.count(), rendered_seconds / elapsed.count());
+  }
+  catch(std::exception& e)
+  {
+    std::cerr << "Caught exception: " << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,76 @@
+#include "nes/rom_catalog.hpp"
+#include <chrono>
+#include <filesystem>
+#include <fmt/format.h>
+#include <iostream>
+#include <vector>
+
+
+const char* status_name(nes::rom_catalog::status_kind status)
+{
+  switch(status)
+  {
+    case nes::rom_catalog::supported: return "ok";
+    case nes::rom_catalog::unsupported_mapper: return "unsupported";
+    default: return "invalid";
+  }
+}
+
+
+const char* mirroring_name(std::uint8_t mirroring)
+{
+  switch(mirroring)
+  {
+    case nes::mapper::horizontal: return "H";
+    case nes::mapper::vertical: return "V";
+    case nes::mapper::four_screen: return "4";
+    default: return "1";
+  }
+}
+
+
+int main(int argc, const char** argv)
+{
+  if(argc < 2)
+  {
+    fmt::print("usage: {} catalog_filename [directory...]\n", argv[0]);
+    fmt::print("  with directories, updates the catalog with the iNES files beneath them, reading only those which changed\n");
+    fmt::print("  without, lists the catalog\n");
+    return 0;
+  }
+
+  try
+  {
+    if(argc > 2)
+    {
+      std::vector<std::filesystem::path> directories(argv + 2, argv + argc);
+
+      auto start = std::chrono::steady_clock::now();
+      nes::rom_catalog catalog = nes::rom_catalog::update(argv[1], directories);
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+      fmt::print(stderr, "cataloged {} files, {} of which were read, in {:.3f} s\n",
+        catalog.entries().size(), catalog.num_indexed(), elapsed.count());
+    }
+    else
+    {
+      nes::rom_catalog catalog = nes::rom_catalog::open(argv[1]);
+
+      fmt::print("{:8} {:40} {:8} {:>6} {:3} {:>5} {:>5} {:11} {}\n", "PRG CRC", "PRG SHA-1", "CHR CRC", "mapper", "mir", "PRG K", "CHR K", "status", "path");
+
+      for(const nes::rom_catalog::entry& e: catalog.entries())
+      {
+        fmt::print("{:08X} {:02x} {:08X} {:>6} {:3} {:>5} {:>5} {:11} {}\n",
+          e.prg_rom_crc32, fmt::join(e.prg_rom_sha1, ""), e.chr_rom_crc32, e.mapper_id, mirroring_name(e.nametable_mirroring),
+          e.prg_rom_size / 1024, e.chr_rom_size / 1024, status_name(e.status), catalog.path(e));
+      }
+    }
+  }
+  catch(std::exception& e)
+  {
+    std::cerr << "Caught exception: " << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}